@@ -0,0 +1,65 @@
+#ifndef ADAPTIVEBINNING_H
+#define ADAPTIVEBINNING_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Binning of one histogram axis
+struct AxisBinning {
+  int n;
+  double min;
+  double max;
+  // Integer valued variable: unit-width (or multiple) bins centred on integers
+  bool integer{false};
+};
+
+// Range and bin count for an axis from a sample of its values. The range
+// covers the 0.1% - 99.9% quantiles plus a 5% margin, so a few outliers go
+// to the under- / overflow instead of stretching the axis, and the bin
+// width follows the Freedman-Diaconis rule. -9999 and below are the
+// "not available" defaults of the analysis and are left out. Too small or
+// degenerate samples keep the fallback binning.
+inline AxisBinning deriveAxisBinning(std::vector<double> values, const AxisBinning &fallback, int maxBins = 2000) {
+  values.erase(std::remove_if(values.begin(), values.end(), [](double v) { return v <= -9999. || !std::isfinite(v); }),
+               values.end());
+  if (values.size() < 100) return fallback;
+  std::sort(values.begin(), values.end());
+  auto quantile = [&](double q) { return values[std::size_t(q * (values.size() - 1))]; };
+  double lo = quantile(0.001);
+  double hi = quantile(0.999);
+  if (!(hi > lo)) return fallback;
+
+  AxisBinning binning;
+  binning.integer = std::all_of(values.begin(), values.end(), [](double v) { return v == floor(v); });
+  double width = 2. * (quantile(0.75) - quantile(0.25)) / cbrt(values.size());
+  double margin = 0.05 * (hi - lo);
+  lo -= margin;
+  hi += margin;
+  if (!(width > 0.)) width = (hi - lo) / 50.;
+  if (binning.integer) {
+    width = std::max(1., round(width));
+    lo = floor(lo) - 0.5;
+    hi = ceil(hi) + 0.5;
+  }
+  binning.n = std::clamp(int(ceil((hi - lo) / width)), 10, maxBins);
+  if (binning.integer) width = std::max(1., ceil((hi - lo) / binning.n));
+  else width = (hi - lo) / binning.n;
+  binning.min = lo;
+  binning.max = lo + binning.n * width;
+  return binning;
+}
+
+// Same range with about factor times the bins, integer axes keep whole-unit bins
+inline AxisBinning shrinkAxisBinning(const AxisBinning &binning, double factor) {
+  AxisBinning shrunk{binning};
+  shrunk.n = std::max(10, int(binning.n * factor));
+  if (binning.integer) {
+    double width = ceil((binning.max - binning.min) / shrunk.n);
+    shrunk.n = int(ceil((binning.max - binning.min) / width));
+    shrunk.max = shrunk.min + shrunk.n * width;
+  }
+  return shrunk;
+}
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef ASYNCFILLER_H
+#define ASYNCFILLER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+// Moves histogram Fill() calls off the event loop: the event thread pushes
+// (histogram, x, y, weight) records into a single-producer / single-consumer
+// ring buffer and a worker thread drains it into the histograms. Records are
+// filled in the order they were pushed, so the histograms come out the same
+// as with direct fills. When the ring is full push() waits for the worker.
+//
+// Histograms must be created on the event thread before their first push,
+// and only be read again after drain().
+template <class Histo>
+class AsyncFiller {
+public:
+  // capacity is rounded up to a power of 2
+  explicit AsyncFiller(std::size_t capacity) {
+    std::size_t size{1};
+    while (size < capacity) size <<= 1;
+    ring_.resize(size);
+    mask_ = size - 1;
+    worker_ = std::thread([this] { run(); });
+  }
+
+  ~AsyncFiller() {
+    if (worker_.joinable()) drain();
+  }
+
+  void push(Histo *histo, double x, double y, double w) {
+    const std::size_t tail{tail_.load(std::memory_order_relaxed)};
+    if (tail - headCache_ > mask_) {
+      headCache_ = head_.load(std::memory_order_acquire);
+      while (tail - headCache_ > mask_) {
+        // Full: back-pressure on the event loop
+        stalls_++;
+        std::this_thread::yield();
+        headCache_ = head_.load(std::memory_order_acquire);
+      }
+    }
+    ring_[tail & mask_] = {histo, x, y, w};
+    tail_.store(tail + 1, std::memory_order_release);
+  }
+
+  // Fills everything pushed so far and stops the worker
+  void drain() {
+    stop_.store(true, std::memory_order_release);
+    worker_.join();
+  }
+
+  // Number of times push() found the ring full
+  uint64_t stalls() const { return stalls_; }
+
+private:
+  struct Record {
+    Histo *histo;
+    double x, y, w;
+  };
+
+  void run() {
+    int idle{0};
+    while (true) {
+      bool stopping{stop_.load(std::memory_order_acquire)};
+      std::size_t head{head_.load(std::memory_order_relaxed)};
+      const std::size_t tail{tail_.load(std::memory_order_acquire)};
+      if (head == tail) {
+        if (stopping) return;
+        // Nothing to do, back off gradually
+        if (++idle < 64) std::this_thread::yield();
+        else std::this_thread::sleep_for(std::chrono::microseconds(50));
+        continue;
+      }
+      idle = 0;
+      while (head != tail) {
+        // Hand the slots back in chunks, so a full ring frees up early
+        const std::size_t end{tail - head > 256 ? head + 256 : tail};
+        for (; head != end; head++) {
+          const Record &r{ring_[head & mask_]};
+          r.histo->Fill(r.x, r.y, r.w);
+        }
+        head_.store(head, std::memory_order_release);
+      }
+    }
+  }
+
+  std::vector<Record> ring_;
+  std::size_t mask_;
+  // Producer and consumer positions on separate cache lines
+  alignas(64) std::atomic<std::size_t> tail_{0};
+  std::size_t headCache_{0};
+  uint64_t stalls_{0};
+  alignas(64) std::atomic<std::size_t> head_{0};
+  std::atomic<bool> stop_{false};
+  std::thread worker_;
+};
+
+#endif
@@ -1,4 +1,5 @@
 #include "Framework/EventProcessor.h"
+#include "Framework/Exception/Exception.h"
 #include "Ecal/Event/EcalVetoResult.h"
 #include "Recon/Event/TriggerResult.h"
 #include "Hcal/Event/HcalVetoResult.h"
@@ -8,9 +9,31 @@
 #include "SimCore/Event/SimTrackerHit.h"
 #include "Tracking/include/Tracking/Event/Track.h"
 #include "Recon/Event/FiducialFlag.h"
-
-
+#include "TruthRecoilSummary.h"
+#include "QuantileSketch.h"
+#include "InputPrefetcher.h"
+#include "AdaptiveBinning.h"
+#include "SharedHistogramStore.h"
+#include "AsyncFiller.h"
+#include "FeatureStream.h"
+
+#include "TFile.h"
+#include "TH2.h"
+#include "TH1D.h"
+#include "TH2D.h"
+#include "TObjString.h"
+#include "TROOT.h"
+#include "TTree.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <utility>
 #include <math.h>
+#include <unistd.h>
 
 // v0: Just a few cuts, establish minimal scenario
 // v1: More strict cuts
@@ -31,7 +54,415 @@
 // v16: Add ignore_fiducial_analysis_, move to recoil from tracking
 // v17: Running on resim sample, 17b adding HCAL plots, print out for surviving everything
 // v18: ldmx-sw v4.2.19, adding CnCwithTracking
+// v19: Read recoil truth from TruthRecoilSummary when available, SimParticles otherwise
+// v20: Declare the input products from the config, optionally read only those branches
+// v21: Book histograms from a spec table on first fill
+// v22: Optional quantile sketches of cut variables per CnC stage
+// v23: Deterministic hashed sub-sampling, weighted fills
+// v24: Optional read-ahead of the next input files
+// v25: Periodic metrics file with rate, cut-flow pass counts and RSS
+// v26: Several fiducial / tagger variants filled in one pass, one directory each
+// v27: Optional block-batched cut evaluation with bulk fills
+// v28: Poisson bootstrap replicas of the cut-flow stage counts
+// v29: Optional adaptive binning from a warm-up buffer of fills
+// v30: Optional per-event cut outcome record for diffCutRecords.py
+// v31: Optional shared memory histograms for the processes of one node
+// v32: Optional histogram filling on a worker thread
+// v33: Per-event kernels compiled for each combination of the mode flags
+// v34: Optional pass-pattern histograms of the cut flows for cutPatterns.py
+// v35: Optional stream of the per-event features for cutQueryDaemon.py
+
+
+// Bin label sets, resolved in getLabels() as some depend on the fiducial choice
+enum LabelSet {
+  kNoLabels,
+  kLabelsCnC,
+  kLabelsCnCWithTracking,
+  kLabelsRev,
+  kLabelsHcalSector,
+  kLabelsAccpt,
+  kLabelsAlt,
+  kLabelsBDT,
+  kLabelsTracking,
+  kLabelsTrackingHcal,
+};
+
+// One entry per row of histSpecs, in the same order
+enum HistId {
+  hAcceptance,
+  hTrigEffVsMissingE,
+  hTrigEffVsRecoilPTAtTarget,
+  hRecoilX,
+  hRecoilXAtTarget,
+  hAvgLayerHit,
+  hDeepestLayerHit,
+  hEcalBackEnergy,
+  hEpAng,
+  hEpSep,
+  hFirstNearPhLayer,
+  hMaxCellDep,
+  hNReadoutHits,
+  hStdLayerHit,
+  hStraight,
+  hLinRegNew,
+  hSummedDet,
+  hSummedTightIso,
+  hShowerRMS,
+  hXStd,
+  hYStd,
+  hBDTDiscr,
+  hBDTDiscrLog,
+  hRecoilPT,
+  hRecoilPZ,
+  hRecoilP,
+  hRecoilPTAtTarget,
+  hRecoilPZAtTarget,
+  hRecoilPAtTarget,
+  hRecoilTheta,
+  hRecoilPhi,
+  hHcal_MaxPE,
+  hHcal_MaxPE_Extended,
+  hHcal_TotalPE,
+  hHcal_TotalPE_AboveMax8PE,
+  hHcal_MaxTiming,
+  hHcal_MaxSector,
+  hBDTDiscrVsHcalPE_PreS,
+  hBDTDiscrLogVsHcalPE_PreS,
+  hBDTDiscrVsHcalPE_PostS,
+  hBDTDiscrLogVsHcalPE_PostS,
+  hAltCutFlow_RecoilX,
+  hStdCutFlow_RecoilX,
+  hStdCutFlowWithTracking_RecoilX,
+  hBDTCutFlow_RecoilX,
+  hTrackingCutFlow_RecoilX,
+  hTracking_TaggerP,
+  hTracking_RecoilN,
+  hTracking_RecoilP,
+  hTracking_RecoilPt,
+  hTracking_RecoilD0,
+  hTracking_RecoilZ0,
+  hTrackingCutFlowHcal_RecoilX,
+  hTrackingHcal_TaggerP,
+  hTrackingHcal_RecoilN,
+  hTrackingHcal_RecoilD0,
+  hTrackingHcal_RecoilZ0,
+  hRev_RecoilX,
+  hRev_AvgLayerHit,
+  hRev_DeepestLayerHit,
+  hRev_EcalBackEnergy,
+  hRev_EpAng,
+  hRev_EpSep,
+  hRev_FirstNearPhLayer,
+  hRev_MaxCellDep,
+  hRev_NReadoutHits,
+  hRev_StdLayerHit,
+  hRev_Straight,
+  hRev_SummedDet,
+  hRev_SummedTightIso,
+  hRev_ShowerRMS,
+  hRev_XStd,
+  hRev_YStd,
+  hRev_Hcal_MaxPE,
+  hRev_Hcal_TotalPE,
+  hRev_Hcal_MaxTiming,
+  hRev_Hcal_MaxSector,
+  kNHists
+};
+
+// Cut flows reported in the metrics file
+enum CutFlow {
+  kFlowCnC,
+  kFlowAlt,
+  kFlowBDT,
+  kFlowCnCWithTracking,
+  kFlowTracking,
+  kFlowTrackingHcal,
+  kFlowRev,
+  kNCutFlows
+};
+
+static const char *cutFlowNames[kNCutFlows] = {"CnC", "Alt", "BDT", "CnCWithTracking", "Tracking", "TrackingHcal", "Rev"};
+static const LabelSet cutFlowLabels[kNCutFlows] = {kLabelsCnC, kLabelsAlt, kLabelsBDT, kLabelsCnCWithTracking,
+                                                   kLabelsTracking, kLabelsTrackingHcal, kLabelsRev};
+
+// One set of fiducial / tagger choices. The main variant comes from the
+// top-level parameters and fills the analyzer directory, extra ones fill a
+// sub-directory named after them from the same event loop.
+struct AnalysisVariant {
+  std::string name;
+  bool fiducial;
+  bool ignoreFiducial;
+  bool ignoreTagger;
+  // Booked histograms indexed by HistId, nullptr until first filled
+  std::vector<TH2 *> hists;
+  std::vector<TH1 *> sketches;
+  std::vector<long> passCounts[kNCutFlows];
+  // Bootstrap replica counts, stage * bootstrap_replicas + replica
+  std::vector<double> replicas[kNCutFlows];
+  // Pass-pattern counts (and vs pattern_variable) of the pattern_flows
+  TH1 *patterns[kNCutFlows]{};
+  TH2 *patternsVsVariable[kNCutFlows]{};
+};
+
+struct HistSpec {
+  HistId id;
+  const char *name;
+  const char *xLabel;
+  int nX;
+  double xMin;
+  double xMax;
+  const char *yLabel;
+  int nY;
+  double yMin;
+  double yMax;
+  LabelSet xLabels;
+  LabelSet yLabels;
+};
+
+// Per-event scalars the cuts and plots are built from, named in featureNames
+enum Feature {
+  fRecoilX,
+  fSummedDet,
+  fSummedTightIso,
+  fEcalBackEnergy,
+  fNReadoutHits,
+  fShowerRMS,
+  fXStd,
+  fYStd,
+  fMaxCellDep,
+  fStdLayerHit,
+  fNStraightTracks,
+  fNLinRegTracks,
+  fAvgLayerHit,
+  fDeepestLayerHit,
+  fFirstNearPhLayer,
+  fEPAng,
+  fEPSep,
+  fBDTDisc,
+  fHcalMaxPE,
+  fHcalTotalPE,
+  fHcalTotalPEAbove8PE,
+  fHcalMaxTiming,
+  fHcalMaxSector,
+  fTruthPT,
+  fTruthPZ,
+  fTruthP,
+  fTruthXAtTarget,
+  fTruthPTAtTarget,
+  fTruthPZAtTarget,
+  fTruthPAtTarget,
+  fTruthThetaAtTarget,
+  fTruthPhiAtTarget,
+  fTaggerP,
+  fRecoilN,
+  fRecoilP,
+  fRecoilPt,
+  fRecoilD0,
+  fRecoilZ0,
+  fBDTDiscLog,
+  fTrigger,
+  fFiducial,
+  fHcalVeto,
+  fAcceptance,
+  fAcceptanceFlag,
+  kNFeatures
+};
+
+static const char *featureNames[kNFeatures] = {
+  "RecoilX",
+  "SummedDet",
+  "SummedTightIso",
+  "EcalBackEnergy",
+  "NReadoutHits",
+  "ShowerRMS",
+  "XStd",
+  "YStd",
+  "MaxCellDep",
+  "StdLayerHit",
+  "NStraightTracks",
+  "NLinRegTracks",
+  "AvgLayerHit",
+  "DeepestLayerHit",
+  "FirstNearPhLayer",
+  "EPAng",
+  "EPSep",
+  "BDTDisc",
+  "HcalMaxPE",
+  "HcalTotalPE",
+  "HcalTotalPEAbove8PE",
+  "HcalMaxTiming",
+  "HcalMaxSector",
+  "TruthPT",
+  "TruthPZ",
+  "TruthP",
+  "TruthXAtTarget",
+  "TruthPTAtTarget",
+  "TruthPZAtTarget",
+  "TruthPAtTarget",
+  "TruthThetaAtTarget",
+  "TruthPhiAtTarget",
+  "TaggerP",
+  "RecoilN",
+  "RecoilP",
+  "RecoilPt",
+  "RecoilD0",
+  "RecoilZ0",
+  "BDTDiscLog",
+  "Trigger",
+  "Fiducial",
+  "HcalVeto",
+  "Acceptance",
+  "AcceptanceFlag",
+};
+
+// Cuts of the cut flows, defined once in cutSpecs for the per-event and the
+// block-batched path
+enum CutId {
+  cAcceptance,
+  cFiducial,        // depends on the variant
+  cTrigger,
+  cSummedDet,
+  cSummedTightIso,
+  cEcalBackEnergy,
+  cNReadoutHits,
+  cShowerRMS,
+  cYStd,
+  cMaxCellDep,
+  cStdLayerHit,
+  cStraightBelow3,
+  cHcalVeto,
+  cBDT,
+  cNoStraight,
+  cEPAng,           // depends on the variant
+  cTaggerP,         // depends on the variant
+  cTaggerPStrict,
+  cRecoilN,
+  cRecoilD0,
+  cRecoilZ0,
+  kNCuts
+};
+
+enum CutTest { tEqual, tBelow, tAbove, tAbsBelow };
+
+struct CutSpec {
+  const char *name;  // as written to the cut record file
+  Feature feature;
+  CutTest test;
+  double value;
+};
+
+static const CutSpec cutSpecs[kNCuts] = {
+  {"Acceptance", fAcceptance, tEqual, 1.},
+  {"Fiducial", fFiducial, tEqual, 1.},  // 0 for the non-fiducial variants
+  {"Trigger", fTrigger, tEqual, 1.},
+  {"SummedDet", fSummedDet, tBelow, 3500},
+  {"SummedTightIso", fSummedTightIso, tBelow, 800},
+  {"EcalBackEnergy", fEcalBackEnergy, tBelow, 250},
+  {"NReadoutHits", fNReadoutHits, tBelow, 70},
+  {"ShowerRMS", fShowerRMS, tBelow, 110},
+  {"YStd", fYStd, tBelow, 70},
+  {"MaxCellDep", fMaxCellDep, tBelow, 300},
+  {"StdLayerHit", fStdLayerHit, tBelow, 5},
+  {"StraightBelow3", fNStraightTracks, tBelow, 3},
+  {"HcalVeto", fHcalVeto, tEqual, 1.},
+  {"BDT", fBDTDisc, tAbove, 0.99741},
+  {"NoStraight", fNStraightTracks, tEqual, 0.},
+  {"EPAng", fEPAng, tAbove, 3},  // fiducial variants only
+  {"TaggerP", fTaggerP, tAbove, 5600},  // not when ignoring the tagger
+  {"TaggerPStrict", fTaggerP, tAbove, 5600},
+  {"RecoilN", fRecoilN, tEqual, 1.},
+  {"RecoilD0", fRecoilD0, tAbsBelow, 10.},
+  {"RecoilZ0", fRecoilZ0, tAbsBelow, 40.},
+};
+
+// Whether a variant applies `cut` at all, those it doesn't apply are passed
+inline bool cutApplies(CutId cut, bool fiducial, bool ignoreFiducial, bool ignoreTagger) {
+  return !(cut == cFiducial && ignoreFiducial) && !(cut == cEPAng && !fiducial) && !(cut == cTaggerP && ignoreTagger);
+}
+
+inline double cutValue(CutId cut, bool fiducial) {
+  return cut == cFiducial ? double(fiducial) : cutSpecs[cut].value;
+}
+
+inline bool passesCut(CutId cut, double x, bool fiducial, bool ignoreFiducial, bool ignoreTagger) {
+  if (!cutApplies(cut, fiducial, ignoreFiducial, ignoreTagger)) return true;
+  const double value{cutValue(cut, fiducial)};
+  switch (cutSpecs[cut].test) {
+  case tEqual: return x == value;
+  case tBelow: return x < value;
+  case tAbove: return x > value;
+  case tAbsBelow: return fabs(x) < value;
+  }
+  return false;
+}
 
+// Histogram filled with (stage, feature) for every stage an event passes
+struct StageFill {
+  HistId id;
+  Feature y;
+};
+
+struct CutFlowSpec {
+  std::vector<CutId> cuts;
+  std::vector<StageFill> fills;
+};
+
+static const CutFlowSpec cutFlowSpecs[kNCutFlows] = {
+  // kFlowCnC
+  {{cAcceptance, cFiducial, cTrigger, cSummedDet, cSummedTightIso, cEcalBackEnergy, cNReadoutHits, cShowerRMS, cYStd,
+    cMaxCellDep, cStdLayerHit, cStraightBelow3, cHcalVeto},
+   {{hRecoilX, fRecoilX}, {hAvgLayerHit, fAvgLayerHit}, {hDeepestLayerHit, fDeepestLayerHit},
+    {hEcalBackEnergy, fEcalBackEnergy}, {hEpAng, fEPAng}, {hEpSep, fEPSep}, {hFirstNearPhLayer, fFirstNearPhLayer},
+    {hMaxCellDep, fMaxCellDep}, {hNReadoutHits, fNReadoutHits}, {hStdLayerHit, fStdLayerHit},
+    {hStraight, fNStraightTracks}, {hLinRegNew, fNLinRegTracks}, {hSummedDet, fSummedDet},
+    {hSummedTightIso, fSummedTightIso}, {hShowerRMS, fShowerRMS}, {hXStd, fXStd}, {hYStd, fYStd},
+    {hBDTDiscr, fBDTDisc}, {hBDTDiscrLog, fBDTDiscLog}, {hStdCutFlow_RecoilX, fRecoilX},
+    {hRecoilPT, fTruthPT}, {hRecoilPZ, fTruthPZ}, {hRecoilP, fTruthP}, {hRecoilXAtTarget, fTruthXAtTarget},
+    {hRecoilPTAtTarget, fTruthPTAtTarget}, {hRecoilPZAtTarget, fTruthPZAtTarget}, {hRecoilPAtTarget, fTruthPAtTarget},
+    {hRecoilTheta, fTruthThetaAtTarget}, {hRecoilPhi, fTruthPhiAtTarget}, {hHcal_MaxPE, fHcalMaxPE},
+    {hHcal_MaxPE_Extended, fHcalMaxPE}, {hHcal_TotalPE, fHcalTotalPE}, {hHcal_TotalPE_AboveMax8PE, fHcalTotalPEAbove8PE},
+    {hHcal_MaxTiming, fHcalMaxTiming}, {hHcal_MaxSector, fHcalMaxSector}}},
+  // kFlowAlt
+  {{cAcceptance, cFiducial, cTrigger, cSummedDet, cSummedTightIso, cEcalBackEnergy, cNReadoutHits, cShowerRMS, cYStd,
+    cMaxCellDep, cStdLayerHit, cStraightBelow3, cHcalVeto},
+   {{hAltCutFlow_RecoilX, fRecoilX}}},
+  // kFlowBDT
+  {{cAcceptance, cFiducial, cTrigger, cBDT, cStraightBelow3, cHcalVeto, cNoStraight, cEPAng},
+   {{hBDTCutFlow_RecoilX, fRecoilX}}},
+  // kFlowCnCWithTracking
+  {{cAcceptance, cFiducial, cTrigger, cTaggerP, cRecoilN, cRecoilD0, cRecoilZ0, cSummedDet, cSummedTightIso,
+    cEcalBackEnergy, cNReadoutHits, cShowerRMS, cYStd, cMaxCellDep, cStdLayerHit, cStraightBelow3, cHcalVeto, cNoStraight},
+   {{hStdCutFlowWithTracking_RecoilX, fRecoilX}}},
+  // kFlowTracking
+  {{cAcceptance, cFiducial, cTrigger, cTaggerP, cRecoilN, cRecoilD0, cRecoilZ0, cBDT, cStraightBelow3, cHcalVeto,
+    cNoStraight, cEPAng},
+   {{hTrackingCutFlow_RecoilX, fRecoilX}, {hTracking_TaggerP, fTaggerP}, {hTracking_RecoilN, fRecoilN},
+    {hTracking_RecoilP, fRecoilP}, {hTracking_RecoilPt, fRecoilPt}, {hTracking_RecoilD0, fRecoilD0},
+    {hTracking_RecoilZ0, fRecoilZ0}}},
+  // kFlowTrackingHcal
+  {{cAcceptance, cFiducial, cTrigger, cHcalVeto, cBDT, cNoStraight, cEPAng, cTaggerPStrict, cRecoilN, cRecoilD0,
+    cRecoilZ0},
+   {{hTrackingCutFlowHcal_RecoilX, fRecoilX}, {hTrackingHcal_TaggerP, fTaggerP}, {hTrackingHcal_RecoilN, fRecoilN},
+    {hTrackingHcal_RecoilD0, fRecoilD0}, {hTrackingHcal_RecoilZ0, fRecoilZ0}}},
+  // kFlowRev
+  {{cAcceptance, cFiducial, cTrigger, cHcalVeto, cStraightBelow3, cStdLayerHit, cMaxCellDep, cYStd, cShowerRMS,
+    cNReadoutHits, cEcalBackEnergy, cSummedTightIso, cSummedDet},
+   {{hRev_AvgLayerHit, fAvgLayerHit}, {hRev_DeepestLayerHit, fDeepestLayerHit}, {hRev_EcalBackEnergy, fEcalBackEnergy},
+    {hRev_EpAng, fEPAng}, {hRev_EpSep, fEPSep}, {hRev_FirstNearPhLayer, fFirstNearPhLayer},
+    {hRev_MaxCellDep, fMaxCellDep}, {hRev_NReadoutHits, fNReadoutHits}, {hRev_StdLayerHit, fStdLayerHit},
+    {hRev_Straight, fNStraightTracks}, {hRev_SummedDet, fSummedDet}, {hRev_SummedTightIso, fSummedTightIso},
+    {hRev_ShowerRMS, fShowerRMS}, {hRev_XStd, fXStd}, {hRev_YStd, fYStd}, {hRev_Hcal_MaxPE, fHcalMaxPE},
+    {hRev_Hcal_TotalPE, fHcalTotalPE}, {hRev_Hcal_MaxTiming, fHcalMaxTiming}, {hRev_Hcal_MaxSector, fHcalMaxSector}}},
+};
+
+// Outcomes of the cuts of `flow` in its order, picked from those of all the
+// cuts; returns the number of cuts. A flow has each cut at most once, so
+// kNCuts outcomes is always enough.
+inline std::size_t flowOutcomes(CutFlow flow, const bool *cutPassed, bool *passed) {
+  const auto &cuts{cutFlowSpecs[flow].cuts};
+  for (std::size_t i = 0; i < cuts.size(); i++) passed[i] = cutPassed[cuts[i]];
+  return cuts.size();
+}
 
 class CutBasedDM : public framework::Analyzer {
 public:
@@ -39,27 +470,363 @@ public:
   : framework::Analyzer(name, p) {}
   ~CutBasedDM() = default;
   void configure(framework::config::Parameters &ps);
-  void setHistLabels(const std::string &name, const std::vector<std::string> &labels);
-  void setHistLabelsY(const std::string &name, const std::vector<std::string> &labels);
+  std::vector<std::string> getLabels(LabelSet set, bool fiducial) const;
+  TH2 *book(HistId id);
+  void fill(HistId id, double x, double y) {
+    if (warmingUp_) {
+      warmupFills_.push_back({int16_t(variant_ - variants_.data()), int16_t(id), x, y, weight_});
+      return;
+    }
+    if (sharedStore_) {
+      sharedStore_->fill((variant_ - variants_.data()) * kNHists + id, x, y, weight_);
+      return;
+    }
+    TH2 *histo{variant_->hists[id]};
+    if (!histo) histo = book(id);
+    if (asyncFiller_) asyncFiller_->push(histo, x, y, weight_);
+    else histo->Fill(x, y, weight_);
+  }
+  void fillN(HistId id, int n, const double *x, const double *y, const double *w) {
+    if (warmingUp_) {
+      for (int i = 0; i < n; i++) warmupFills_.push_back({int16_t(variant_ - variants_.data()), int16_t(id), x[i], y[i], w[i]});
+      return;
+    }
+    if (sharedStore_) {
+      for (int i = 0; i < n; i++) sharedStore_->fill((variant_ - variants_.data()) * kNHists + id, x[i], y[i], w[i]);
+      return;
+    }
+    TH2 *histo{variant_->hists[id]};
+    if (!histo) histo = book(id);
+    if (asyncFiller_) {
+      for (int i = 0; i < n; i++) asyncFiller_->push(histo, x[i], y[i], w[i]);
+    } else {
+      histo->FillN(n, x, y, w);
+    }
+  }
+  void endWarmup();
+  void loadBinning(const std::string &fileName);
+  std::string binningTable() const;
+
+  void fillSketches(int stage, const double *features);
+
+  // Stage counters of a cut flow: metrics file and bootstrap replicas
+  void countPassed(CutFlow flow, const bool *passed, size_t n) {
+    if (cutMask_) {
+      for (size_t i=0;i<n;i++) *cutMask_ |= uint32_t(passed[i]) << cutFlowSpecs[flow].cuts[i];
+    }
+    if (patternFlows_[flow]) {
+      uint32_t pattern{0};
+      for (size_t i=0;i<n;i++) pattern |= uint32_t(passed[i]) << i;
+      fillPattern(flow, pattern, patternValue_);
+    }
+    size_t nPassed{0};
+    while (nPassed < n && passed[nPassed]) nPassed++;
+    countStages(flow, n, nPassed);
+  }
+  void countStages(CutFlow flow, size_t nStages, size_t nPassed) {
+    if (!metrics_file_.empty()) {
+      auto &counts{variant_->passCounts[flow]};
+      counts.resize(nStages, 0);
+      for (size_t i=0;i<nPassed;i++) counts[i]++;
+    }
+    if (bootstrapFlows_[flow]) {
+      auto &replicas{variant_->replicas[flow]};
+      const int n{bootstrap_replicas_};
+      replicas.resize(nStages * n, 0.);
+      for (size_t i=0;i<nPassed;i++) {
+        double *counts{&replicas[i * n]};
+        for (int r = 0; r < n; r++) counts[r] += weight_ * replicaWeights_[r];
+      }
+    }
+  }
+  void writeReplicas();
+  void fillPattern(CutFlow flow, uint32_t pattern, double value);
+  void writeCutRecords();
+  void writeSharedHistograms();
+  void writeMetrics();
+  void cdVariantDirectory();
+
+  void processBlock();
+  void evaluateCut(const AnalysisVariant &variant, CutId cut, uint8_t *pass) const;
+  void fillStages(HistId id, const uint8_t *nPassed, const double *y);
 
   void onProcessStart();
+  void onFileOpen(framework::EventFile &eventFile);
+  void onFileClose(framework::EventFile &eventFile);
+  void onProcessEnd();
   void analyze(const framework::Event& event) final;
+
+  // Per-event kernels specialised on the mode flags, the instantiations for
+  // this job and its variants are picked in configure()
+  template <bool kSignal, bool kLoadTagger>
+  void analyzeEvent(const framework::Event &event);
+  template <bool kSignal, bool kFiducial, bool kIgnoreFiducial, bool kIgnoreTagger>
+  void analyzeVariant(const ldmx::EcalVetoResult &vetoNew, const ldmx::HcalVetoResult &hcalVeto,
+                      const ldmx::TriggerResult &trigResult, const double *features);
+  using EventKernel = void (CutBasedDM::*)(const framework::Event &);
+  using VariantKernel = void (CutBasedDM::*)(const ldmx::EcalVetoResult &, const ldmx::HcalVetoResult &,
+                                             const ldmx::TriggerResult &, const double *);
+  // analyzeVariant<> for mode bits signal, fiducial, ignore fiducial, ignore tagger
+  template <std::size_t... kModes>
+  static std::vector<VariantKernel> variantKernelTable(std::index_sequence<kModes...>) {
+    return {&CutBasedDM::analyzeVariant<bool(kModes & 8), bool(kModes & 4), bool(kModes & 2), bool(kModes & 1)>...};
+  }
   template <typename T, size_t n>
   bool passPreselection(T (&passedCutsArray)[n], bool verbose);
-  std::tuple<int, const ldmx::SimParticle *> getRecoilEle(
-    const std::map<int, ldmx::SimParticle> &particleMap);
   std::string trigger_collName_;
   std::string trigger_passName_;
+  std::string ecal_veto_collName_;
+  std::string ecal_veto_passName_;
+  std::string hcal_veto_collName_;
+  std::string hcal_veto_passName_;
+  std::string hcal_rechits_passName_;
+  std::string tagger_track_collection_;
+  std::string tagger_track_passName_;
   std::string sp_pass_name_;
   std::string track_pass_name_;
-  // std::string tagger_track_collection_;
   std::string recoil_track_collection_;
+  std::string truth_summary_collection_;
+  std::string truth_summary_pass_;
+  // Flags of the variant being filled, see variants_
   bool fiducial_analysis_;
   bool ignore_fiducial_analysis_;
   bool ignore_tagger_analysis_;
   bool signal_;
+  // (collection, pass) of everything analyze() reads, pass "" matches any
+  std::vector<std::pair<std::string, std::string>> inputs_;
+  bool read_declared_inputs_only_;
+  std::vector<AnalysisVariant> variants_;
+  AnalysisVariant *variant_{nullptr};
+  bool load_tagger_tracks_;
+  EventKernel eventKernel_;
+  std::vector<VariantKernel> variantKernels_;
+  // Quantile sketches of quantileVars_ per CnC cut-flow stage, booked on first fill
+  static constexpr int kNSketchStages{13};
+  QuantileSketchLayout sketchLayout_;
+  std::vector<Feature> quantileVars_;
+  long nEvents_{0};
+  // Hashed sub-sampling: keep sample_fraction of the events, chosen by
+  // (run, event), and weight every fill by the inverse of the keep rate
+  double sample_fraction_;
+  bool sample_keep_triggered_;
+  uint64_t sample_seed_;
+  double weight_{1.};
+  long nSampledOut_{0};
+  // Read-ahead of the next prefetch_depth input files, off for depth 0
+  std::vector<std::string> prefetch_files_;
+  int prefetch_depth_;
+  int prefetch_budget_mb_;
+  std::unique_ptr<InputPrefetcher> prefetcher_;
+  // Metrics in the Prometheus text format, rewritten every metrics_period_s
+  std::string metrics_file_;
+  double metrics_period_s_;
+  std::string currentInputFile_;
+  std::chrono::steady_clock::time_point startTime_;
+  std::chrono::steady_clock::time_point lastMetricsTime_;
+  long lastMetricsEvents_{0};
+  // Batched mode: features of batch_size events as one column per Feature,
+  // cuts and fills run column-wise once the block is full
+  int batch_size_;
+  std::vector<std::vector<double>> block_;
+  std::vector<double> blockWeights_;
+  int blockSize_{0};
+  // fillStages() input, reused across calls
+  std::vector<double> stageXs_, stageYs_, stageWs_;
+  // Poisson(1) bootstrap: every event enters replica r with a weight drawn
+  // from (run, event, r), so replicas stay the same across jobs and merge
+  int bootstrap_replicas_;
+  uint64_t bootstrap_seed_;
+  bool bootstrapFlows_[kNCutFlows]{};
+  // Pass patterns: bit i set if cut i of the flow passed, counted in a
+  // 2^(number of cuts) bin histogram, optionally vs one coarse variable.
+  // Up to the 13 cuts of CnC / Rev: 8192 bins, ~1 MB per flow vs 10 bins
+  static constexpr std::size_t kMaxPatternCuts{13};
+  bool patternFlows_[kNCutFlows]{};
+  Feature patternVariable_{kNFeatures};
+  int pattern_variable_bins_;
+  double pattern_variable_min_;
+  double pattern_variable_max_;
+  double patternValue_{0.};
+  std::vector<uint8_t> eventReplicaWeights_;
+  std::vector<uint8_t> blockReplicaWeights_;
+  const uint8_t *replicaWeights_{nullptr};
+  // Adaptive binning: histogram fills of the first adaptive_warmup_events
+  // kept events are buffered, the axes derived from them, then the buffer is
+  // replayed into the histograms and filling goes on as usual
+  struct FillRecord {
+    int16_t variant;
+    int16_t id;
+    double x, y, w;
+  };
+  bool adaptive_binning_;
+  int adaptive_warmup_events_;
+  double adaptive_buffer_mb_;
+  double adaptive_memory_mb_;
+  std::string adaptive_binning_file_;
+  bool warmingUp_{false};
+  std::vector<FillRecord> warmupFills_;
+  // Per HistId x and y axis binning used by book()
+  std::vector<std::pair<AxisBinning, AxisBinning>> binning_;
+  // Cut record: run, event and a mask of the passed CutIds per variant for
+  // every kept event, sorted and written at the end of the job
+  std::string cut_record_file_;
+  std::vector<uint32_t> cutRecords_;
+  uint32_t *cutMask_{nullptr};
+  // Name of the shared memory segment the histograms are filled into, shared
+  // by all processes on the node using the same name
+  std::string shared_histograms_;
+  std::unique_ptr<SharedHistogramStore> sharedStore_;
+  // Histogram fills handed to a worker thread through a ring buffer of
+  // async_fill_buffer records, 0 fills on the event thread
+  int async_fill_buffer_;
+  std::unique_ptr<AsyncFiller<TH2>> asyncFiller_;
+  // Features and weight of every kept event, to a file or "unix:<socket>"
+  std::string feature_stream_;
+  std::unique_ptr<FeatureStream> featureStream_;
+  long nStreamed_{0};
 };
 
+// splitmix64 of (run, event): the same events are picked by every job and
+// version for a given seed
+inline uint64_t eventHash(int run, int event, uint64_t seed) {
+  uint64_t z = seed + ((uint64_t(uint32_t(run)) << 32) | uint32_t(event)) + 0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+// n draws from Poisson(1), one per bootstrap replica, from the event hash
+inline void drawPoisson1(uint64_t hash, int n, uint8_t *draws) {
+  // P(k <= i) for Poisson(1)
+  static const double cdf[] = {0.36787944117144233, 0.7357588823428847, 0.9196986029286058, 0.9810118431238462,
+                               0.9963401531726563, 0.9994058151824183, 0.9999167588507119, 0.9999897508033253,
+                               0.9999988747974020, 0.9999998885745217, 0.9999999899522337};
+  for (int r = 0; r < n; r++) {
+    double u = (eventHash(int(hash >> 32), int(hash), r) >> 11) * 0x1.0p-53;
+    uint8_t k{0};
+    while (k < sizeof(cdf) / sizeof(double) && u >= cdf[k]) k++;
+    draws[r] = k;
+  }
+}
+
+
+// Every histogram the analyzer can fill. Nothing is allocated up front:
+// a histogram is created and labelled on its first fill (see book()), so
+// families that are never filled (e.g. Tracking* without tracking,
+// Acceptance for background) cost neither memory nor output size.
+static constexpr HistSpec histSpecs[] = {
+  {hAcceptance, "Acceptance", "", 6, -0.5, 5.5, "", 90, -450.0, 450.0, kLabelsAccpt, kNoLabels},
+  {hTrigEffVsMissingE, "TrigEffVsMissingE", "Triggered?", 2, -0.5, 1.5, "Missing ECAL energy [MeV]", 100, 0.0, 10000.0, kNoLabels, kNoLabels},
+  {hTrigEffVsRecoilPTAtTarget, "TrigEffVsRecoilPTAtTarget", "Triggered?", 2, -0.5, 1.5, "Recoil p_{T} @Target [MeV]", 800, 0.0, 10000.0, kNoLabels, kNoLabels},
+  {hRecoilX, "RecoilX", "", 20, -0.5, 19.5, "RecoilX @Ecal [mm]", 90, -450.0, 450.0, kLabelsCnC, kNoLabels},
+  {hRecoilXAtTarget, "RecoilXAtTarget", "", 20, -0.5, 19.5, "RecoilX @Target [mm]", 90, -450.0, 450.0, kLabelsCnC, kNoLabels},
+  {hAvgLayerHit, "AvgLayerHit", "", 20, -0.5, 19.5, "Avg hit layer", 34, -0.5, 33.5, kLabelsCnC, kNoLabels},
+  {hDeepestLayerHit, "DeepestLayerHit", "", 20, -0.5, 19.5, "Deepest hit layer", 34, -0.5, 33.5, kLabelsCnC, kNoLabels},
+  {hEcalBackEnergy, "EcalBackEnergy", "", 20, -0.5, 19.5, "Ecal back energy [MeV]", 100, 0.0, 3000.0, kLabelsCnC, kNoLabels},
+  {hEpAng, "EpAng", "", 20, -0.5, 19.5, "EpAng", 100, 0.0, 90.0, kLabelsCnC, kNoLabels},
+  {hEpSep, "EpSep", "", 20, -0.5, 19.5, "EpSep", 100, 0.0, 1000.0, kLabelsCnC, kNoLabels},
+  {hFirstNearPhLayer, "FirstNearPhLayer", "", 20, -0.5, 19.5, "First near PhLayer", 34, -0.5, 33.5, kLabelsCnC, kNoLabels},
+  {hMaxCellDep, "MaxCellDep", "", 20, -0.5, 19.5, "Max cell deposition [MeV]", 100, 0.0, 800.0, kLabelsCnC, kNoLabels},
+  {hNReadoutHits, "NReadoutHits", "", 20, -0.5, 19.5, "#Readout hits", 150, -0.5, 149.5, kLabelsCnC, kNoLabels},
+  {hStdLayerHit, "StdLayerHit", "", 20, -0.5, 19.5, "Std of hit layers", 70, -0.5, 34.5, kLabelsCnC, kNoLabels},
+  {hStraight, "Straight", "", 20, -0.5, 19.5, "Straight tracks", 15, -0.5, 14.5, kLabelsCnC, kNoLabels},
+  {hLinRegNew, "LinRegNew", "", 20, -0.5, 19.5, "Linear regression tracks", 15, -0.5, 14.5, kLabelsCnC, kNoLabels},
+  {hSummedDet, "SummedDet", "", 20, -0.5, 19.5, "Summed ECAL energy [MeV]", 100, 0.0, 10000.0, kLabelsCnC, kNoLabels},
+  {hSummedTightIso, "SummedTightIso", "", 20, -0.5, 19.5, "Summed ECAL energy with tight iso [MeV]", 100, 0.0, 10000.0, kLabelsCnC, kNoLabels},
+  {hShowerRMS, "ShowerRMS", "", 20, -0.5, 19.5, "Shower RMS [mm]", 100, 0.0, 250.0, kLabelsCnC, kNoLabels},
+  {hXStd, "XStd", "", 20, -0.5, 19.5, "Shower RMS_{X} [mm]", 100, 0.0, 250.0, kLabelsCnC, kNoLabels},
+  {hYStd, "YStd", "", 20, -0.5, 19.5, "Shower RMS_{Y} [mm]", 100, 0.0, 250.0, kLabelsCnC, kNoLabels},
+  {hBDTDiscr, "BDTDiscr", "", 20, -0.5, 19.5, "BDT discriminating score", 100, 0.0, 1.0, kLabelsCnC, kNoLabels},
+  {hBDTDiscrLog, "BDTDiscrLog", "", 20, -0.5, 19.5, "-log(1-BDT discriminating score)", 100, 0.0, 5.0, kLabelsCnC, kNoLabels},
+
+  {hRecoilPT, "RecoilPT", "", 20, -0.5, 19.5, "Recoil p_{T} [MeV]", 200, 0.0, 1000.0, kLabelsCnC, kNoLabels},
+  {hRecoilPZ, "RecoilPZ", "", 20, -0.5, 19.5, "Recoil p_{Z} [MeV]", 800, -10.0, 8010.0, kLabelsCnC, kNoLabels},
+  {hRecoilP, "RecoilP", "", 20, -0.5, 19.5, "Recoil p [MeV]", 2000, 0.0, 10000.0, kLabelsCnC, kNoLabels},
+  {hRecoilPTAtTarget, "RecoilPTAtTarget", "", 20, -0.5, 19.5, "Recoil p_{T} @Target [MeV]", 400, 0.0, 4000.0, kLabelsCnC, kNoLabels},
+  {hRecoilPZAtTarget, "RecoilPZAtTarget", "", 20, -0.5, 19.5, "Recoil p_{Z} @Target [MeV]", 800, -10.0, 8010.0, kLabelsCnC, kNoLabels},
+  {hRecoilPAtTarget, "RecoilPAtTarget", "", 20, -0.5, 19.5, "Recoil p @Target [MeV]", 800, 0.0, 10000.0, kLabelsCnC, kNoLabels},
+  {hRecoilTheta, "RecoilTheta", "", 20, -0.5, 19.5, "Recoil theta @Target", 90, 0.0, 90.0, kLabelsCnC, kNoLabels},
+  {hRecoilPhi, "RecoilPhi", "", 20, -0.5, 19.5, "Recoil phi @Target", 360, -180.0, 180.0, kLabelsCnC, kNoLabels},
+
+  {hHcal_MaxPE, "Hcal_MaxPE", "", 20, -0.5, 19.5, "HCAL max photo-electron hits", 65, -0.5, 64.5, kLabelsCnC, kNoLabels},
+  {hHcal_MaxPE_Extended, "Hcal_MaxPE_Extended", "", 20, -0.5, 19.5, "HCAL max photo-electron hits", 120, -0.5, 600.5, kLabelsCnC, kNoLabels},
+  {hHcal_TotalPE, "Hcal_TotalPE", "", 20, -0.5, 19.5, "HCAL total photo-electron hits", 100, -0.5, 200.5, kLabelsCnC, kNoLabels},
+  {hHcal_TotalPE_AboveMax8PE, "Hcal_TotalPE_AboveMax8PE", "", 20, -0.5, 19.5, "HCAL total photo-electron hits (for MaxPE > 8)", 200, -0.5, 400.5, kLabelsCnC, kNoLabels},
+  {hHcal_MaxTiming, "Hcal_MaxTiming", "", 20, -0.5, 19.5, "HCAL timing of the max PE hit", 35, 0.0, 35.0, kLabelsCnC, kNoLabels},
+  {hHcal_MaxSector, "Hcal_MaxSector", "", 20, -0.5, 19.5, "", 5, -0.5, 4.5, kLabelsCnC, kLabelsHcalSector},
+
+  {hBDTDiscrVsHcalPE_PreS, "BDTDiscrVsHcalPE_PreS", "HCAL PE", 500, -0.5, 500.5, "BDT discriminating score", 100, 0.0, 1.0, kNoLabels, kNoLabels},
+  {hBDTDiscrLogVsHcalPE_PreS, "BDTDiscrLogVsHcalPE_PreS", "HCAL PE", 500, -0.5, 500.5, "-log(1-BDT discriminating score)", 100, 0.0, 5.0, kNoLabels, kNoLabels},
+  {hBDTDiscrVsHcalPE_PostS, "BDTDiscrVsHcalPE_PostS", "HCAL PE", 500, -0.5, 500.5, "BDT discriminating score", 100, 0.0, 1.0, kNoLabels, kNoLabels},
+  {hBDTDiscrLogVsHcalPE_PostS, "BDTDiscrLogVsHcalPE_PostS", "HCAL PE", 500, -0.5, 500.5, "-log(1-BDT discriminating score)", 100, 0.0, 5.0, kNoLabels, kNoLabels},
+
+  {hAltCutFlow_RecoilX, "AltCutFlow_RecoilX", "", 18, -0.5, 17.5, "RecoilX @Ecal [mm]", 90, -450.0, 450.0, kLabelsAlt, kNoLabels},
+  {hStdCutFlow_RecoilX, "StdCutFlow_RecoilX", "", 18, -0.5, 17.5, "RecoilX @Ecal [mm]", 90, -450.0, 450.0, kLabelsCnC, kNoLabels},
+  {hStdCutFlowWithTracking_RecoilX, "StdCutFlowWithTracking_RecoilX", "", 20, -0.5, 19.5, "RecoilX @Ecal [mm]", 90, -450.0, 450.0, kLabelsCnCWithTracking, kNoLabels},
+  {hBDTCutFlow_RecoilX, "BDTCutFlow_RecoilX", "", 18, -0.5, 17.5, "RecoilX @Ecal [mm]", 90, -450.0, 450.0, kLabelsBDT, kNoLabels},
+  // {hLinRegCutFlow_RecoilX, "LinRegCutFlow_RecoilX", "", 18, -0.5, 17.5, "RecoilX @Ecal [mm]", 90, -450.0, 450.0, kNoLabels, kNoLabels},
+  // {hLinRegCutFlowHcal_RecoilX, "LinRegCutFlowHcal_RecoilX", "", 18, -0.5, 17.5, "RecoilX @Ecal [mm]", 90, -450.0, 450.0, kNoLabels, kNoLabels},
+
+  {hTrackingCutFlow_RecoilX, "TrackingCutFlow_RecoilX", "", 18, -0.5, 17.5, "RecoilX @Ecal [mm]", 90, -450.0, 450.0, kLabelsTracking, kNoLabels},
+  {hTracking_TaggerP, "Tracking_TaggerP", "", 18, -0.5, 17.5, "Tagger p [MeV]", 800, 0.0, 10000.0, kLabelsTracking, kNoLabels},
+  {hTracking_RecoilN, "Tracking_RecoilN", "", 18, -0.5, 17.5, "N_{recoil}", 10, -0.5, 9.5, kLabelsTracking, kNoLabels},
+  {hTracking_RecoilP, "Tracking_RecoilP", "", 18, -0.5, 17.5, "Recoil p [MeV]", 2000, 0.0, 10000.0, kLabelsTracking, kNoLabels},
+  {hTracking_RecoilPt, "Tracking_RecoilPt", "", 18, -0.5, 17.5, "Recoil p_{T} [MeV]", 200, 0.0, 1000.0, kLabelsTracking, kNoLabels},
+  {hTracking_RecoilD0, "Tracking_RecoilD0", "", 18, -0.5, 17.5, "d_{0} [mm]", 100, -50.0, 50.0, kLabelsTracking, kNoLabels},
+  {hTracking_RecoilZ0, "Tracking_RecoilZ0", "", 18, -0.5, 17.5, "z_{0} [mm]", 100, -50.0, 50.0, kLabelsTracking, kNoLabels},
+  {hTrackingCutFlowHcal_RecoilX, "TrackingCutFlowHcal_RecoilX", "", 18, -0.5, 17.5, "RecoilX @Ecal [mm]", 90, -450.0, 450.0, kLabelsTrackingHcal, kNoLabels},
+  {hTrackingHcal_TaggerP, "TrackingHcal_TaggerP", "", 18, -0.5, 17.5, "Tagger p [MeV]", 2000, 0.0, 10000.0, kLabelsTrackingHcal, kNoLabels},
+  {hTrackingHcal_RecoilN, "TrackingHcal_RecoilN", "", 18, -0.5, 17.5, "N_{recoil}", 10, -0.5, 9.5, kLabelsTrackingHcal, kNoLabels},
+  {hTrackingHcal_RecoilD0, "TrackingHcal_RecoilD0", "", 18, -0.5, 17.5, "d_{0} [mm]", 100, -50.0, 50.0, kLabelsTrackingHcal, kNoLabels},
+  {hTrackingHcal_RecoilZ0, "TrackingHcal_RecoilZ0", "", 18, -0.5, 17.5, "z_{0} [mm]", 100, -50.0, 50.0, kLabelsTrackingHcal, kNoLabels},
+
+  // Reverse direction
+  {hRev_RecoilX, "Rev_RecoilX", "", 20, -0.5, 19.5, "RecoilX [mm]", 90, -450.0, 450.0, kNoLabels, kNoLabels},
+  {hRev_AvgLayerHit, "Rev_AvgLayerHit", "", 20, -0.5, 19.5, "Avg hit layer", 34, -0.5, 33.5, kLabelsRev, kNoLabels},
+  {hRev_DeepestLayerHit, "Rev_DeepestLayerHit", "", 20, -0.5, 19.5, "Deepest hit layer", 34, -0.5, 33.5, kLabelsRev, kNoLabels},
+  {hRev_EcalBackEnergy, "Rev_EcalBackEnergy", "", 20, -0.5, 19.5, "Ecal back energy [MeV]", 100, 0.0, 3000.0, kLabelsRev, kNoLabels},
+  {hRev_EpAng, "Rev_EpAng", "", 20, -0.5, 19.5, "EpAng", 100, 0.0, 90.0, kLabelsRev, kNoLabels},
+  {hRev_EpSep, "Rev_EpSep", "", 20, -0.5, 19.5, "EpSep", 100, 0.0, 1000.0, kLabelsRev, kNoLabels},
+  {hRev_FirstNearPhLayer, "Rev_FirstNearPhLayer", "", 20, -0.5, 19.5, "First near PhLayer", 34, -0.5, 33.5, kLabelsRev, kNoLabels},
+  {hRev_MaxCellDep, "Rev_MaxCellDep", "", 20, -0.5, 19.5, "Max cell deposition [MeV]", 100, 0.0, 800.0, kLabelsRev, kNoLabels},
+  {hRev_NReadoutHits, "Rev_NReadoutHits", "", 20, -0.5, 19.5, "#Readout hits", 150, -0.5, 149.5, kLabelsRev, kNoLabels},
+  {hRev_StdLayerHit, "Rev_StdLayerHit", "", 20, -0.5, 19.5, "Std of hit layers", 70, -0.5, 34.5, kLabelsRev, kNoLabels},
+  {hRev_Straight, "Rev_Straight", "", 20, -0.5, 19.5, "Straight tracks", 15, -0.5, 14.5, kLabelsRev, kNoLabels},
+  // {hRev_LinRegNew, "Rev_LinRegNew", "", 20, -0.5, 19.5, "Linear regression tracks", 15, -0.5, 14.5, kNoLabels, kNoLabels},
+  {hRev_SummedDet, "Rev_SummedDet", "", 20, -0.5, 19.5, "Summed ECAL energy [MeV]", 100, 0.0, 10000.0, kLabelsRev, kNoLabels},
+  {hRev_SummedTightIso, "Rev_SummedTightIso", "", 20, -0.5, 19.5, "Summed ECAL energy with tight iso [MeV]", 100, 0.0, 10000.0, kLabelsRev, kNoLabels},
+  {hRev_ShowerRMS, "Rev_ShowerRMS", "", 20, -0.5, 19.5, "Shower RMS [mm]", 100, 0.0, 250.0, kLabelsRev, kNoLabels},
+  {hRev_XStd, "Rev_XStd", "", 20, -0.5, 19.5, "Shower RMS_{X} [mm]", 100, 0.0, 250.0, kLabelsRev, kNoLabels},
+  {hRev_YStd, "Rev_YStd", "", 20, -0.5, 19.5, "Shower RMS_{Y} [mm]", 100, 0.0, 250.0, kLabelsRev, kNoLabels},
+  {hRev_Hcal_MaxPE, "Rev_Hcal_MaxPE", "", 20, -0.5, 19.5, "HCAL max photo-electron hits", 65, -0.5, 64.5, kLabelsRev, kNoLabels},
+  {hRev_Hcal_TotalPE, "Rev_Hcal_TotalPE", "", 20, -0.5, 19.5, "HCAL total photo-electron hits", 100, -0.5, 200.5, kNoLabels, kNoLabels},
+  {hRev_Hcal_MaxTiming, "Rev_Hcal_MaxTiming", "", 20, -0.5, 19.5, "HCAL timing of the max PE hit", 35, 0.0, 35.0, kLabelsRev, kNoLabels},
+  {hRev_Hcal_MaxSector, "Rev_Hcal_MaxSector", "", 20, -0.5, 19.5, "", 5, -0.5, 4.5, kLabelsRev, kLabelsHcalSector},
+
+  // N-1 plots
+  // {hN1_EcalBackEnergy, "N1_EcalBackEnergy", "", 20, -0.5, 19.5, "Ecal back energy [MeV]", 100, 0.0, 3000.0, kNoLabels, kNoLabels},
+  // {hN1_MaxCellDep, "N1_MaxCellDep", "", 20, -0.5, 19.5, "Max cell deposition [MeV]", 100, 0.0, 800.0, kNoLabels, kNoLabels},
+  // {hN1_NReadoutHits, "N1_NReadoutHits", "", 20, -0.5, 19.5, "#Readout hits", 150, -0.5, 149.5, kNoLabels, kNoLabels},
+  // {hN1_StdLayerHit, "N1_StdLayerHit", "", 20, -0.5, 19.5, "Std of hit layers", 70, -0.5, 34.5, kNoLabels, kNoLabels},
+  // {hN1_Straight, "N1_Straight", "", 20, -0.5, 19.5, "Straight tracks", 15, -0.5, 14.5, kNoLabels, kNoLabels},
+  // {hN1_SummedDet, "N1_SummedDet", "", 20, -0.5, 19.5, "Summed ECAL energy [MeV]", 100, 0.0, 10000.0, kNoLabels, kNoLabels},
+  // {hN1_SummedTightIso, "N1_SummedTightIso", "", 20, -0.5, 19.5, "Summed ECAL energy with tight iso [MeV]", 100, 0.0, 10000.0, kNoLabels, kNoLabels},
+  // {hN1_ShowerRMS, "N1_ShowerRMS", "", 20, -0.5, 19.5, "Shower RMS [mm]", 100, 0.0, 250.0, kNoLabels, kNoLabels},
+  // {hN1_YStd, "N1_YStd", "", 20, -0.5, 19.5, "Shower RMS_{Y} [mm]", 100, 0.0, 250.0, kNoLabels, kNoLabels},
+  // {hN1_Hcal_MaxPE, "N1_Hcal_MaxPE", "", 20, -0.5, 19.5, "HCAL max photo-electron hits", 65, -0.5, 64.5, kNoLabels, kNoLabels},
+  // {hN1_Hcal_TotalPE, "N1_Hcal_TotalPE", "", 20, -0.5, 19.5, "HCAL total photo-electron hits", 100, -0.5, 200.5, kNoLabels, kNoLabels},
+  // {hN1_Hcal_MaxTiming, "N1_Hcal_MaxTiming", "", 20, -0.5, 19.5, "HCAL timing of the max PE hit", 35, 0.0, 35.0, kNoLabels, kNoLabels},
+  // {hN1_Hcal_MaxSector, "N1_Hcal_MaxSector", "", 20, -0.5, 19.5, "", 5, -0.5, 4.5, kNoLabels, kNoLabels},
+};
+static_assert(sizeof(histSpecs) / sizeof(HistSpec) == kNHists, "histSpecs must have one entry per HistId");
+
+constexpr bool histSpecsInOrder() {
+  for (int i = 0; i < kNHists; i++) {
+    if (histSpecs[i].id != i) return false;
+  }
+  return true;
+}
+static_assert(histSpecsInOrder(), "histSpecs must be listed in HistId order");
 
 void CutBasedDM::configure(framework::config::Parameters &ps) {
   trigger_collName_ = ps.getParameter<std::string>("trigger_name");
@@ -67,140 +834,231 @@ void CutBasedDM::configure(framework::config::Parameters &ps) {
   sp_pass_name_ = ps.getParameter<std::string>("sp_pass_name");
   track_pass_name_ = ps.getParameter<std::string>("track_pass_name","");
   recoil_track_collection_ = ps.getParameter<std::string>("recoil_track_collection","");
+  truth_summary_collection_ = ps.getParameter<std::string>("truth_summary_collection","TruthRecoilSummary");
+  truth_summary_pass_ = ps.getParameter<std::string>("truth_summary_pass","");
   fiducial_analysis_ = ps.getParameter<bool>("fiducial_analysis");
   ignore_fiducial_analysis_ = ps.getParameter<bool>("ignore_fiducial_analysis");
   ignore_tagger_analysis_ = ps.getParameter<bool>("ignore_tagger_analysis",false);
+  variants_ = {{"", fiducial_analysis_, ignore_fiducial_analysis_, ignore_tagger_analysis_}};
+  for (const auto &variant : ps.getParameter<std::vector<framework::config::Parameters>>("variants", {})) {
+    std::string name = variant.getParameter<std::string>("name");
+    if (name.empty() || std::any_of(variants_.begin(), variants_.end(), [&](const auto &v) { return v.name == name; })) {
+      EXCEPTION_RAISE("BadConf", "Analysis variants need a unique, non-empty name, got '" + name + "'");
+    }
+    variants_.push_back({name, variant.getParameter<bool>("fiducial_analysis"),
+                         variant.getParameter<bool>("ignore_fiducial_analysis", false),
+                         variant.getParameter<bool>("ignore_tagger_analysis", false)});
+  }
+  load_tagger_tracks_ = std::any_of(variants_.begin(), variants_.end(), [](const auto &v) { return !v.ignoreTagger; });
   signal_ = ps.getParameter<bool>("signal", true);
+  static const EventKernel eventKernels[2][2] = {
+    {&CutBasedDM::analyzeEvent<false, false>, &CutBasedDM::analyzeEvent<false, true>},
+    {&CutBasedDM::analyzeEvent<true, false>, &CutBasedDM::analyzeEvent<true, true>}};
+  static const std::vector<VariantKernel> variantKernels{variantKernelTable(std::make_index_sequence<16>())};
+  eventKernel_ = eventKernels[signal_][load_tagger_tracks_];
+  variantKernels_.clear();
+  for (const auto &v : variants_) {
+    variantKernels_.push_back(variantKernels[signal_ * 8 + v.fiducial * 4 + v.ignoreFiducial * 2 + v.ignoreTagger]);
+  }
+  ecal_veto_collName_ = ps.getParameter<std::string>("ecal_veto_collection","EcalVetoNew");
+  ecal_veto_passName_ = ps.getParameter<std::string>("ecal_veto_pass","");
+  hcal_veto_collName_ = ps.getParameter<std::string>("hcal_veto_collection","HcalVeto");
+  hcal_veto_passName_ = ps.getParameter<std::string>("hcal_veto_pass","cutbased");
+  hcal_rechits_passName_ = ps.getParameter<std::string>("hcal_rechits_pass","");
+  tagger_track_collection_ = ps.getParameter<std::string>("tagger_track_collection","TaggerTracks");
+  tagger_track_passName_ = ps.getParameter<std::string>("tagger_track_pass","cutbased");
+  read_declared_inputs_only_ = ps.getParameter<bool>("read_declared_inputs_only", false);
+
+  sample_fraction_ = ps.getParameter<double>("sample_fraction", 1.);
+  sample_keep_triggered_ = ps.getParameter<bool>("sample_keep_triggered", true);
+  sample_seed_ = ps.getParameter<int>("sample_seed", 0);
+  if (sample_fraction_ <= 0. || sample_fraction_ > 1.) {
+    EXCEPTION_RAISE("BadConf", "sample_fraction must be in (0, 1]");
+  }
 
-  return;
-}
+  prefetch_files_ = ps.getParameter<std::vector<std::string>>("prefetch_files", {});
+  prefetch_depth_ = ps.getParameter<int>("prefetch_depth", 0);
+  prefetch_budget_mb_ = ps.getParameter<int>("prefetch_budget_mb", 2000);
+  if (prefetch_depth_ > 0 && read_declared_inputs_only_) {
+    // The read-ahead pulls in whole files, selective reading is the larger saving
+    EXCEPTION_RAISE("BadConf", "prefetch_depth reads every branch of the input files, "
+                               "set it to 0 with read_declared_inputs_only");
+  }
+
+  batch_size_ = ps.getParameter<int>("batch_size", 0);
+
+  adaptive_binning_ = ps.getParameter<bool>("adaptive_binning", false);
+  adaptive_warmup_events_ = ps.getParameter<int>("adaptive_warmup_events", 5000);
+  adaptive_buffer_mb_ = ps.getParameter<double>("adaptive_buffer_mb", 200.);
+  adaptive_memory_mb_ = ps.getParameter<double>("adaptive_memory_mb", 500.);
+  adaptive_binning_file_ = ps.getParameter<std::string>("adaptive_binning_file", "");
+  shared_histograms_ = ps.getParameter<std::string>("shared_histograms", "");
+  async_fill_buffer_ = ps.getParameter<int>("async_fill_buffer", 0);
+  feature_stream_ = ps.getParameter<std::string>("feature_stream", "");
+  if (!shared_histograms_.empty() && adaptive_binning_ && adaptive_binning_file_.empty()) {
+    EXCEPTION_RAISE("BadConf", "Shared histograms need the same binning in every process, use adaptive_binning_file");
+  }
 
-void CutBasedDM::setHistLabels(const std::string &name,
-  const std::vector<std::string> &labels) {
-    auto histo{histograms_.get(name)};
-    for (std::size_t ibin{1}; ibin <= labels.size(); ibin++) {
-      histo->GetXaxis()->SetBinLabel(ibin, labels[ibin - 1].c_str());
+  bootstrap_replicas_ = ps.getParameter<int>("bootstrap_replicas", 0);
+  bootstrap_seed_ = ps.getParameter<int>("bootstrap_seed", 0);
+  if (bootstrap_replicas_ > 0) {
+    for (const auto &name : ps.getParameter<std::vector<std::string>>("bootstrap_flows", {"BDT", "Tracking", "TrackingHcal"})) {
+      auto flow{std::find(std::begin(cutFlowNames), std::end(cutFlowNames), name)};
+      if (flow == std::end(cutFlowNames)) {
+        EXCEPTION_RAISE("BadConf", "Unknown bootstrap cut flow " + name);
+      }
+      bootstrapFlows_[flow - std::begin(cutFlowNames)] = true;
+    }
+  }
+
+  for (const auto &name : ps.getParameter<std::vector<std::string>>("pattern_flows", {})) {
+    auto flow{std::find(std::begin(cutFlowNames), std::end(cutFlowNames), name)};
+    if (flow == std::end(cutFlowNames)) {
+      EXCEPTION_RAISE("BadConf", "Unknown pattern cut flow " + name);
+    }
+    if (cutFlowSpecs[flow - std::begin(cutFlowNames)].cuts.size() > kMaxPatternCuts) {
+      EXCEPTION_RAISE("BadConf", "Too many cuts in " + name + " for a pattern histogram, at most " +
+                                 std::to_string(kMaxPatternCuts));
     }
+    patternFlows_[flow - std::begin(cutFlowNames)] = true;
+  }
+  std::string patternVariable{ps.getParameter<std::string>("pattern_variable", "")};
+  if (!patternVariable.empty()) {
+    auto feature{std::find(std::begin(featureNames), std::end(featureNames), patternVariable)};
+    if (feature == std::end(featureNames)) {
+      EXCEPTION_RAISE("BadConf", "Unknown pattern variable " + patternVariable);
+    }
+    patternVariable_ = Feature(feature - std::begin(featureNames));
+  }
+  pattern_variable_bins_ = ps.getParameter<int>("pattern_variable_bins", 10);
+  pattern_variable_min_ = ps.getParameter<double>("pattern_variable_min", 0.);
+  pattern_variable_max_ = ps.getParameter<double>("pattern_variable_max", 1.);
+
+  metrics_file_ = ps.getParameter<std::string>("metrics_file", "");
+  cut_record_file_ = ps.getParameter<std::string>("cut_record_file", "");
+  metrics_period_s_ = ps.getParameter<double>("metrics_period_s", 30.);
+
+  sketchLayout_ = QuantileSketchLayout(ps.getParameter<double>("quantile_alpha", 0.01));
+  for (const auto &var : ps.getParameter<std::vector<std::string>>("quantile_variables", {})) {
+    auto feature{std::find(std::begin(featureNames), std::end(featureNames), var)};
+    if (feature == std::end(featureNames)) {
+      EXCEPTION_RAISE("BadConf", "Unknown quantile variable " + var);
+    }
+    quantileVars_.push_back(Feature(feature - std::begin(featureNames)));
+  }
+
+  inputs_ = {
+    {ecal_veto_collName_, ecal_veto_passName_},
+    {trigger_collName_, trigger_passName_},
+    {hcal_veto_collName_, hcal_veto_passName_},
+    {"HcalRecHits", hcal_rechits_passName_},
+    {recoil_track_collection_, track_pass_name_},
+    // Only one of these two sets is read per event, depending on what the file has
+    {truth_summary_collection_, truth_summary_pass_},
+    {"SimParticles", ""},
+    {"TargetScoringPlaneHits", sp_pass_name_},
+  };
+  if (load_tagger_tracks_) inputs_.push_back({tagger_track_collection_, tagger_track_passName_});
+  if (signal_) inputs_.push_back({"RecoilTruthFiducialFlags", ""});
+
+  return;
 }
 
-void CutBasedDM::setHistLabelsY(const std::string &name,
-  const std::vector<std::string> &labels) {
-    auto histo{histograms_.get(name)};
-    for (std::size_t ibin{1}; ibin <= labels.size(); ibin++) {
-      histo->GetYaxis()->SetBinLabel(ibin, labels[ibin - 1].c_str());
+void CutBasedDM::onFileOpen(framework::EventFile &eventFile) {
+  currentInputFile_ = eventFile.getFileName();
+  if (prefetch_depth_ > 0 && prefetch_files_.size() > 1) {
+    if (!prefetcher_) {
+      prefetcher_ = std::make_unique<InputPrefetcher>(prefetch_files_, prefetch_depth_, int64_t(prefetch_budget_mb_) << 20);
+    }
+    prefetcher_->opened(eventFile.getFileName());
+  }
+  if (!read_declared_inputs_only_) return;
+
+  // Switch off every input branch but the declared ones, so only those are
+  // read from disk. Products made earlier in this process are not affected,
+  // but upstream producers lose their inputs: only use for analysis-only jobs.
+  auto inFile{dynamic_cast<TFile *>(gROOT->GetListOfFiles()->FindObject(eventFile.getFileName().c_str()))};
+  TTree *tree = inFile ? inFile->Get<TTree>("LDMX_Events") : nullptr;
+  if (!tree) {
+    ldmx_log(warn) << "Could not find the event tree of " << eventFile.getFileName()
+                   << ", reading all branches";
+    return;
+  }
+  // The SimParticles / Target SP hits fallback is only read without a summary
+  bool hasSummary{false};
+  if (!truth_summary_collection_.empty()) {
+    std::string prefix{truth_summary_collection_ + "_" + truth_summary_pass_};
+    for (auto branch : *tree->GetListOfBranches()) {
+      if (std::string(branch->GetName()).rfind(prefix, 0) == 0) hasSummary = true;
     }
+  }
+  tree->SetBranchStatus("*", false);
+  tree->SetBranchStatus("EventHeader*", true);
+  for (const auto &[coll, pass] : inputs_) {
+    if (coll.empty()) continue;
+    if (hasSummary && (coll == "SimParticles" || coll == "TargetScoringPlaneHits")) continue;
+    std::string branch = coll + "_" + pass + "*";
+    tree->SetBranchStatus(branch.c_str(), true);
+  }
 }
 
-void CutBasedDM::onProcessStart(){
-  getHistoDirectory();
-  
-  histograms_.create("Acceptance", "", 6, -0.5, 5.5, "", 90, -450.0, 450.0);
-  histograms_.create("TrigEffVsMissingE", "Triggered?", 2, -0.5, 1.5, "Missing ECAL energy [MeV]", 100, 0.0, 10000.0);
-  histograms_.create("TrigEffVsRecoilPTAtTarget", "Triggered?", 2, -0.5, 1.5, "Recoil p_{T} @Target [MeV]", 800, 0.0, 10000.0);
-  histograms_.create("RecoilX", "", 20, -0.5, 19.5, "RecoilX @Ecal [mm]", 90, -450.0, 450.0);
-  histograms_.create("RecoilXAtTarget", "", 20, -0.5, 19.5, "RecoilX @Target [mm]", 90, -450.0, 450.0);
-  histograms_.create("AvgLayerHit", "", 20, -0.5, 19.5, "Avg hit layer", 34, -0.5, 33.5);
-  histograms_.create("DeepestLayerHit", "", 20, -0.5, 19.5, "Deepest hit layer", 34, -0.5, 33.5);
-  histograms_.create("EcalBackEnergy", "", 20, -0.5, 19.5, "Ecal back energy [MeV]", 100, 0.0, 3000.0);
-  histograms_.create("EpAng", "", 20, -0.5, 19.5, "EpAng", 100, 0.0, 90.0);
-  histograms_.create("EpSep", "", 20, -0.5, 19.5, "EpSep", 100, 0.0, 1000.0);
-  histograms_.create("FirstNearPhLayer", "", 20, -0.5, 19.5, "First near PhLayer", 34, -0.5, 33.5);
-  histograms_.create("MaxCellDep", "", 20, -0.5, 19.5, "Max cell deposition [MeV]", 100, 0.0, 800.0);
-  histograms_.create("NReadoutHits", "", 20, -0.5, 19.5, "#Readout hits", 150, -0.5, 149.5);
-  histograms_.create("StdLayerHit", "", 20, -0.5, 19.5, "Std of hit layers", 70, -0.5, 34.5);
-  histograms_.create("Straight", "", 20, -0.5, 19.5, "Straight tracks", 15, -0.5, 14.5);
-  histograms_.create("LinRegNew", "", 20, -0.5, 19.5, "Linear regression tracks", 15, -0.5, 14.5);
-  histograms_.create("SummedDet", "", 20, -0.5, 19.5, "Summed ECAL energy [MeV]", 100, 0.0, 10000.0);
-  histograms_.create("SummedTightIso", "", 20, -0.5, 19.5, "Summed ECAL energy with tight iso [MeV]", 100, 0.0, 10000.0);
-  histograms_.create("ShowerRMS", "", 20, -0.5, 19.5, "Shower RMS [mm]", 100, 0.0, 250.0);
-  histograms_.create("XStd", "", 20, -0.5, 19.5, "Shower RMS_{X} [mm]", 100, 0.0, 250.0);
-  histograms_.create("YStd", "", 20, -0.5, 19.5, "Shower RMS_{Y} [mm]", 100, 0.0, 250.0);
-  histograms_.create("BDTDiscr", "", 20, -0.5, 19.5, "BDT discriminating score", 100, 0.0, 1.0);
-  histograms_.create("BDTDiscrLog", "", 20, -0.5, 19.5, "-log(1-BDT discriminating score)", 100, 0.0, 5.0);
-   
-  histograms_.create("RecoilPT", "", 20, -0.5, 19.5, "Recoil p_{T} [MeV]", 200, 0.0, 1000.0);
-  histograms_.create("RecoilPZ", "", 20, -0.5, 19.5, "Recoil p_{Z} [MeV]", 800, -10.0, 8010.0);
-  histograms_.create("RecoilP", "", 20, -0.5, 19.5, "Recoil p [MeV]", 2000, 0.0, 10000.0);
-  histograms_.create("RecoilPTAtTarget", "", 20, -0.5, 19.5, "Recoil p_{T} @Target [MeV]", 400, 0.0, 4000.0);
-  histograms_.create("RecoilPZAtTarget", "", 20, -0.5, 19.5, "Recoil p_{Z} @Target [MeV]", 800, -10.0, 8010.0);
-  histograms_.create("RecoilPAtTarget", "", 20, -0.5, 19.5, "Recoil p @Target [MeV]", 800, 0.0, 10000.0);
-  histograms_.create("RecoilTheta", "", 20, -0.5, 19.5, "Recoil theta @Target", 90, 0.0, 90.0);
-  histograms_.create("RecoilPhi", "", 20, -0.5, 19.5, "Recoil phi @Target", 360, -180.0, 180.0);
-
-
-  histograms_.create("Hcal_MaxPE", "", 20, -0.5, 19.5, "HCAL max photo-electron hits", 65, -0.5, 64.5);
-  histograms_.create("Hcal_MaxPE_Extended", "", 20, -0.5, 19.5, "HCAL max photo-electron hits", 120, -0.5, 600.5);
-  histograms_.create("Hcal_TotalPE", "", 20, -0.5, 19.5, "HCAL total photo-electron hits", 100, -0.5, 200.5);
-  histograms_.create("Hcal_TotalPE_AboveMax8PE", "", 20, -0.5, 19.5, "HCAL total photo-electron hits (for MaxPE > 8)", 200, -0.5, 400.5);
-  histograms_.create("Hcal_MaxTiming", "", 20, -0.5, 19.5, "HCAL timing of the max PE hit", 35, 0.0, 35.0);
-  histograms_.create("Hcal_MaxSector", "", 20, -0.5, 19.5, "", 5, -0.5, 4.5);
-
-  histograms_.create("BDTDiscrVsHcalPE_PreS", "HCAL PE", 500, -0.5, 500.5, "BDT discriminating score", 100, 0.0, 1.0);
-  histograms_.create("BDTDiscrLogVsHcalPE_PreS", "HCAL PE", 500, -0.5, 500.5, "-log(1-BDT discriminating score)", 100, 0.0, 5.0);
-  histograms_.create("BDTDiscrVsHcalPE_PostS", "HCAL PE", 500, -0.5, 500.5, "BDT discriminating score", 100, 0.0, 1.0);
-  histograms_.create("BDTDiscrLogVsHcalPE_PostS", "HCAL PE", 500, -0.5, 500.5, "-log(1-BDT discriminating score)", 100, 0.0, 5.0);
-
-  histograms_.create("AltCutFlow_RecoilX", "", 18, -0.5, 17.5, "RecoilX @Ecal [mm]", 90, -450.0, 450.0);
-  histograms_.create("StdCutFlow_RecoilX", "", 18, -0.5, 17.5, "RecoilX @Ecal [mm]", 90, -450.0, 450.0);
-  histograms_.create("StdCutFlowWithTracking_RecoilX", "", 20, -0.5, 19.5, "RecoilX @Ecal [mm]", 90, -450.0, 450.0);
-  histograms_.create("BDTCutFlow_RecoilX", "", 18, -0.5, 17.5, "RecoilX @Ecal [mm]", 90, -450.0, 450.0);
-  // histograms_.create("LinRegCutFlow_RecoilX", "",  18, -0.5, 17.5, "RecoilX @Ecal [mm]", 90, -450.0, 450.0);
-  // histograms_.create("LinRegCutFlowHcal_RecoilX", "",  18, -0.5, 17.5, "RecoilX @Ecal [mm]", 90, -450.0, 450.0);
- 
-  histograms_.create("TrackingCutFlow_RecoilX", "", 18, -0.5, 17.5, "RecoilX @Ecal [mm]", 90, -450.0, 450.0);
-  histograms_.create("Tracking_TaggerP", "", 18, -0.5, 17.5, "Tagger p [MeV]", 800, 0.0, 10000.0);
-  histograms_.create("Tracking_RecoilN", "", 18, -0.5, 17.5, "N_{recoil}", 10, -0.5, 9.5);
-  histograms_.create("Tracking_RecoilP", "", 18, -0.5, 17.5, "Recoil p [MeV]", 2000, 0.0, 10000.0);
-  histograms_.create("Tracking_RecoilPt", "", 18, -0.5, 17.5, "Recoil p_{T} [MeV]", 200, 0.0, 1000.0);
-  histograms_.create("Tracking_RecoilD0", "", 18, -0.5, 17.5, "d_{0} [mm]", 100, -50.0, 50.0);
-  histograms_.create("Tracking_RecoilZ0", "", 18, -0.5, 17.5, "z_{0} [mm]", 100, -50.0, 50.0);
-  histograms_.create("TrackingCutFlowHcal_RecoilX", "", 18, -0.5, 17.5, "RecoilX @Ecal [mm]", 90, -450.0, 450.0);
-  histograms_.create("TrackingHcal_TaggerP", "", 18, -0.5, 17.5, "Tagger p [MeV]", 2000, 0.0, 10000.0);
-  histograms_.create("TrackingHcal_RecoilN", "", 18, -0.5, 17.5, "N_{recoil}", 10, -0.5, 9.5);
-  histograms_.create("TrackingHcal_RecoilD0", "", 18, -0.5, 17.5, "d_{0} [mm]", 100, -50.0, 50.0);
-  histograms_.create("TrackingHcal_RecoilZ0", "", 18, -0.5, 17.5, "z_{0} [mm]", 100, -50.0, 50.0);
+void CutBasedDM::onFileClose(framework::EventFile &eventFile) {
+  if (prefetcher_) prefetcher_->closed(eventFile.getFileName());
+}
 
-  // Reverse direction
-  histograms_.create("Rev_RecoilX", "", 20, -0.5, 19.5, "RecoilX [mm]", 90, -450.0, 450.0);
-  histograms_.create("Rev_AvgLayerHit", "", 20, -0.5, 19.5, "Avg hit layer", 34, -0.5, 33.5);
-  histograms_.create("Rev_DeepestLayerHit", "", 20, -0.5, 19.5, "Deepest hit layer", 34, -0.5, 33.5);
-  histograms_.create("Rev_EcalBackEnergy", "", 20, -0.5, 19.5, "Ecal back energy [MeV]", 100, 0.0, 3000.0);
-  histograms_.create("Rev_EpAng", "", 20, -0.5, 19.5, "EpAng", 100, 0.0, 90.0);
-  histograms_.create("Rev_EpSep", "", 20, -0.5, 19.5, "EpSep", 100, 0.0, 1000.0);
-  histograms_.create("Rev_FirstNearPhLayer", "", 20, -0.5, 19.5, "First near PhLayer", 34, -0.5, 33.5);
-  histograms_.create("Rev_MaxCellDep", "", 20, -0.5, 19.5, "Max cell deposition [MeV]", 100, 0.0, 800.0);
-  histograms_.create("Rev_NReadoutHits", "", 20, -0.5, 19.5, "#Readout hits", 150, -0.5, 149.5);
-  histograms_.create("Rev_StdLayerHit", "", 20, -0.5, 19.5, "Std of hit layers", 70, -0.5, 34.5);
-  histograms_.create("Rev_Straight", "", 20, -0.5, 19.5, "Straight tracks", 15, -0.5, 14.5);
-  // histograms_.create("Rev_LinRegNew", "", 20, -0.5, 19.5, "Linear regression tracks", 15, -0.5, 14.5);
-  histograms_.create("Rev_SummedDet", "", 20, -0.5, 19.5, "Summed ECAL energy [MeV]", 100, 0.0, 10000.0);
-  histograms_.create("Rev_SummedTightIso", "", 20, -0.5, 19.5, "Summed ECAL energy with tight iso [MeV]", 100, 0.0, 10000.0);
-  histograms_.create("Rev_ShowerRMS", "", 20, -0.5, 19.5, "Shower RMS [mm]", 100, 0.0, 250.0);
-  histograms_.create("Rev_XStd", "", 20, -0.5, 19.5, "Shower RMS_{X} [mm]", 100, 0.0, 250.0);
-  histograms_.create("Rev_YStd", "", 20, -0.5, 19.5, "Shower RMS_{Y} [mm]", 100, 0.0, 250.0);
-  histograms_.create("Rev_Hcal_MaxPE", "", 20, -0.5, 19.5, "HCAL max photo-electron hits", 65, -0.5, 64.5);
-  histograms_.create("Rev_Hcal_TotalPE", "", 20, -0.5, 19.5, "HCAL total photo-electron hits", 100, -0.5, 200.5);
-  histograms_.create("Rev_Hcal_MaxTiming", "", 20, -0.5, 19.5, "HCAL timing of the max PE hit", 35, 0.0, 35.0);
-  histograms_.create("Rev_Hcal_MaxSector", "", 20, -0.5, 19.5, "", 5, -0.5, 4.5);
+void CutBasedDM::onProcessEnd() {
+  if (blockSize_ > 0) processBlock();
+  if (warmingUp_) endWarmup();
+  if (asyncFiller_) {
+    asyncFiller_->drain();
+    ldmx_log(info) << "Histogram fill buffer was full " << asyncFiller_->stalls() << " times";
+    asyncFiller_.reset();
+  }
+  if (sharedStore_) writeSharedHistograms();
+  if (featureStream_) {
+    featureStream_->flush();
+    if (featureStream_->good()) {
+      ldmx_log(info) << "Streamed the features of " << nStreamed_ << " events to " << feature_stream_;
+    } else {
+      ldmx_log(warn) << "Feature stream to " << feature_stream_ << " broke off, it is incomplete";
+    }
+    featureStream_.reset();
+  }
+  if (adaptive_binning_ || !adaptive_binning_file_.empty()) {
+    // Recorded next to the histograms, to be passed on as adaptive_binning_file
+    TDirectory::TContext ctx;
+    getHistoDirectory();
+    TObjString table(binningTable().c_str());
+    table.Write("AdaptiveBinning");
+  }
+  if (bootstrap_replicas_ > 0) writeReplicas();
+  if (!cut_record_file_.empty()) writeCutRecords();
+  if (!metrics_file_.empty()) writeMetrics();
+  if (prefetcher_) {
+    for (const auto &file : prefetcher_->corrupted()) {
+      ldmx_log(warn) << "Input file " << file << " looks truncated or not closed properly";
+    }
+    for (const auto &file : prefetcher_->unreadable()) {
+      ldmx_log(info) << "Could not prefetch input file " << file;
+    }
+    ldmx_log(info) << "Prefetched " << prefetcher_->bytesPrefetched() / 1.e6 << " MB of input files ahead of the event loop";
+    prefetcher_.reset();
+  }
+  double bytesRead = TFile::GetFileBytesRead();
+  ldmx_log(info) << "Read " << bytesRead / 1.e6 << " MB from input files in " << nEvents_ << " events"
+                 << (read_declared_inputs_only_ ? " (declared inputs only)" : "")
+                 << ", " << (nEvents_ > 0 ? bytesRead / nEvents_ / 1.e3 : 0.) << " kB/event";
+  if (sample_fraction_ < 1.) {
+    ldmx_log(info) << "Sub-sampling at " << sample_fraction_ << (sample_keep_triggered_ ? " (all triggered kept)" : "")
+                   << ": skipped " << nSampledOut_ << " of " << nEvents_ << " events";
+  }
+}
 
-  // N-1 plots
-  // histograms_.create("N1_EcalBackEnergy", "", 20, -0.5, 19.5, "Ecal back energy [MeV]", 100, 0.0, 3000.0);
-  // histograms_.create("N1_MaxCellDep", "", 20, -0.5, 19.5, "Max cell deposition [MeV]", 100, 0.0, 800.0);
-  // histograms_.create("N1_NReadoutHits", "", 20, -0.5, 19.5, "#Readout hits", 150, -0.5, 149.5);
-  // histograms_.create("N1_StdLayerHit", "", 20, -0.5, 19.5, "Std of hit layers", 70, -0.5, 34.5);
-  // histograms_.create("N1_Straight", "", 20, -0.5, 19.5, "Straight tracks", 15, -0.5, 14.5);
-  // histograms_.create("N1_SummedDet", "", 20, -0.5, 19.5, "Summed ECAL energy [MeV]", 100, 0.0, 10000.0);
-  // histograms_.create("N1_SummedTightIso", "", 20, -0.5, 19.5, "Summed ECAL energy with tight iso [MeV]", 100, 0.0, 10000.0);
-  // histograms_.create("N1_ShowerRMS", "", 20, -0.5, 19.5, "Shower RMS [mm]", 100, 0.0, 250.0);
-  // histograms_.create("N1_YStd", "", 20, -0.5, 19.5, "Shower RMS_{Y} [mm]", 100, 0.0, 250.0);
-  // histograms_.create("N1_Hcal_MaxPE", "", 20, -0.5, 19.5, "HCAL max photo-electron hits", 65, -0.5, 64.5);
-  // histograms_.create("N1_Hcal_TotalPE", "", 20, -0.5, 19.5, "HCAL total photo-electron hits", 100, -0.5, 200.5);
-  // histograms_.create("N1_Hcal_MaxTiming", "", 20, -0.5, 19.5, "HCAL timing of the max PE hit", 35, 0.0, 35.0);
-  // histograms_.create("N1_Hcal_MaxSector", "", 20, -0.5, 19.5, "", 5, -0.5, 4.5);
-
-  // histograms_.create("N1_EcalBackEnergy", "", 20, -0.5, 19.5, "Ecal back energy [MeV]", 100, 0.0, 3000.0);
-
-  std::vector<std::string> labels = {
+std::vector<std::string> CutBasedDM::getLabels(LabelSet set, bool fiducial) const {
+  std::vector<std::string> labels;
+  switch (set) {
+  case kLabelsCnC:
+    labels = {
     "All / Acceptance",
     "Fiducial",              // 1
     "Triggerred",            // 2
@@ -215,60 +1073,11 @@ void CutBasedDM::onProcessStart(){
     "N_{straight} < 3",           // 11
     "PE_{HCal,max} < 8",            // 12
     };
-    
-  if (!fiducial_analysis_) labels.at(1) = "Non-fiducial";
-
-  setHistLabels("AvgLayerHit", labels);
-  setHistLabels("DeepestLayerHit", labels);
-  setHistLabels("EcalBackEnergy", labels);
-  setHistLabels("EpAng", labels);
-  setHistLabels("EpSep", labels);
-  setHistLabels("FirstNearPhLayer", labels);
-  setHistLabels("MaxCellDep", labels);
-  setHistLabels("NReadoutHits", labels);
-  setHistLabels("StdLayerHit", labels);
-  setHistLabels("Straight", labels);
-  setHistLabels("LinRegNew", labels);
-  setHistLabels("SummedDet", labels);
-  setHistLabels("SummedTightIso", labels);
-  setHistLabels("ShowerRMS", labels);
-  setHistLabels("XStd", labels);
-  setHistLabels("YStd", labels);
-  setHistLabels("BDTDiscr", labels);
-  setHistLabels("BDTDiscrLog", labels);
-  setHistLabels("StdCutFlow_RecoilX", labels);
-
-  setHistLabels("RecoilX", labels);
-  setHistLabels("RecoilPT", labels);
-  setHistLabels("RecoilPZ", labels);
-  setHistLabels("RecoilP", labels);
-  setHistLabels("RecoilXAtTarget", labels);
-  setHistLabels("RecoilPTAtTarget", labels);
-  setHistLabels("RecoilPZAtTarget", labels);
-  setHistLabels("RecoilPAtTarget", labels);
-  setHistLabels("RecoilTheta", labels);
-  setHistLabels("RecoilPhi", labels);
-  setHistLabels("Hcal_MaxPE", labels);
-  setHistLabels("Hcal_MaxPE_Extended", labels);
-  setHistLabels("Hcal_TotalPE", labels);
-  setHistLabels("Hcal_TotalPE_AboveMax8PE", labels);
-  setHistLabels("Hcal_MaxTiming", labels);
-  setHistLabels("Hcal_MaxSector", labels);
-
-  // setHistLabels("N1_EcalBackEnergy", labels);
-  // setHistLabels("N1_MaxCellDep", labels);
-  // setHistLabels("N1_NReadoutHits", labels);
-  // setHistLabels("N1_StdLayerHit", labels);
-  // setHistLabels("N1_Straight", labels);
-  // setHistLabels("N1_SummedDet", labels);
-  // setHistLabels("N1_SummedTightIso", labels);
-  // setHistLabels("N1_ShowerRMS", labels);
-  // setHistLabels("N1_YStd", labels);
-  // setHistLabels("N1_Hcal_MaxPE", labels);
-  // setHistLabels("N1_Hcal_MaxTiming", labels);
-  // setHistLabels("N1_Hcal_MaxSector", labels);
-
-  std::vector<std::string> labelsWithTracking = {
+    if (!fiducial) labels.at(1) = "Non-fiducial";
+    break;
+
+  case kLabelsCnCWithTracking:
+    labels = {
     "All / Acceptance",
     "Fiducial",              // 1
     "Triggerred",            // 2
@@ -288,12 +1097,11 @@ void CutBasedDM::onProcessStart(){
     "PE_{HCal,max} < 8",            // 12
     "N_{straight} = 0",           //
     };
-    
-  if (!fiducial_analysis_) labelsWithTracking.at(1) = "Non-fiducial";
+    if (!fiducial) labels.at(1) = "Non-fiducial";
+    break;
 
-  setHistLabels("StdCutFlowWithTracking_RecoilX", labelsWithTracking);
-  
-  std::vector<std::string> labels_Rev = {
+  case kLabelsRev:
+    labels = {
     "All / Acceptance",      // 0
     "Fiducial",              // 1
     "Triggerred",            // 2
@@ -308,43 +1116,22 @@ void CutBasedDM::onProcessStart(){
     "E_{SumTight} < 800",        // 4
     "E_{sum} < 3500",       // 3
     };
-
-  if (!fiducial_analysis_) labels_Rev.at(1) = "Non-fiducial";
-  setHistLabels("Rev_AvgLayerHit", labels_Rev);
-  setHistLabels("Rev_DeepestLayerHit", labels_Rev);
-  setHistLabels("Rev_EcalBackEnergy", labels_Rev);
-  setHistLabels("Rev_EpAng", labels_Rev);
-  setHistLabels("Rev_EpSep", labels_Rev);
-  setHistLabels("Rev_FirstNearPhLayer", labels_Rev);
-  setHistLabels("Rev_MaxCellDep", labels_Rev);
-  setHistLabels("Rev_NReadoutHits", labels_Rev);
-  setHistLabels("Rev_StdLayerHit", labels_Rev);
-  setHistLabels("Rev_Straight", labels_Rev);
-  // setHistLabels("Rev_LinRegNew", labels_Rev);
-  setHistLabels("Rev_SummedDet", labels_Rev);
-  setHistLabels("Rev_SummedTightIso", labels_Rev);
-  setHistLabels("Rev_ShowerRMS", labels_Rev);
-  setHistLabels("Rev_XStd", labels_Rev);
-  setHistLabels("Rev_YStd", labels_Rev);
-  setHistLabels("Rev_Hcal_MaxPE", labels_Rev);
-  setHistLabels("Rev_Hcal_MaxTiming", labels_Rev);
-  setHistLabels("Rev_Hcal_MaxSector", labels_Rev);
- 
+    if (!fiducial) labels.at(1) = "Non-fiducial";
+    break;
 
   // enum HcalSection { BACK = 0, TOP = 1, BOTTOM = 2, RIGHT = 3, LEFT = 4 };
-  std::vector<std::string> labels_HCALsector = {
+  case kLabelsHcalSector:
+    labels = {
     "HCAL BACK",         // 0
     "HCAL TOP",          // 1
     "HCAL BOTTOM",       // 2
     "HCAL RIGHT",        // 3
     "HCAL LEFT",         // 4
     };
+    break;
 
-  setHistLabelsY("Hcal_MaxSector", labels_HCALsector);
-  // setHistLabelsY("N1_Hcal_MaxSector", labels_HCALsector);
-  setHistLabelsY("Rev_Hcal_MaxSector", labels_HCALsector);
-
-  std::vector<std::string> labels_accpt = {
+  case kLabelsAccpt:
+    labels = {
       "All",         // 0
       "Min energy",  // 1
       "Min tk hits", // 2
@@ -352,184 +1139,747 @@ void CutBasedDM::onProcessStart(){
       "Hcal hit",    // 4
       "Acceptance"   // 5
       };
-  setHistLabels("Acceptance", labels_accpt);
-
-  // enum HcalSection { BACK = 0, TOP = 1, BOTTOM = 2, RIGHT = 3, LEFT = 4 };
-  std::vector<std::string> labels_AltCutFlow = {
-  "All",
-  "Triggerred",            // 1
-  "Fiducial",              // 2
-  "E_{sum} < 3500",       // 3
-  "E_{SumTight} < 800",        // 4
-  "E_{back} < 250",             // 5
-  "N_{hits} < 70",              // 6
-  "RMS_{shower} < 110",         // 7
-  "RMS_{shower,Y} < 70",        // 8
-  "E_{cell,max} < 300",     // 9
-  "RMS_{Layer,hit} < 5",        // 10
-  "N_{straight} < 3",           // 11
-  "PE_{HCal,max} < 8",            // 12
-  };
-  if (!fiducial_analysis_) labels_AltCutFlow.at(2) = "Non-fiducial";
-
-  setHistLabels("AltCutFlow_RecoilX",labels_AltCutFlow);
+    break;
 
+  case kLabelsAlt:
+    labels = {
+    "All",
+    "Triggerred",            // 1
+    "Fiducial",              // 2
+    "E_{sum} < 3500",       // 3
+    "E_{SumTight} < 800",        // 4
+    "E_{back} < 250",             // 5
+    "N_{hits} < 70",              // 6
+    "RMS_{shower} < 110",         // 7
+    "RMS_{shower,Y} < 70",        // 8
+    "E_{cell,max} < 300",     // 9
+    "RMS_{Layer,hit} < 5",        // 10
+    "N_{straight} < 3",           // 11
+    "PE_{HCal,max} < 8",            // 12
+    };
+    if (!fiducial) labels.at(2) = "Non-fiducial";
+    break;
 
   // CutFlow labels for BDT
-  std::vector<std::string> labels_BDTCutFlow = {
-  "All / Acceptance",      // 0
-  "Fiducial",              // 1
-  "Triggerred",            // 2
-  "Ecal BDT",              // 3
-  "N_{straight} < 3",      // 4
-  "PE_{HCal,max} < 8",       // 5
-  "N_{straight} = 0",      // 6
-  "Angle_{e,ph} > 3.",     // 7
-  };
+  case kLabelsBDT:
+    labels = {
+    "All / Acceptance",      // 0
+    "Fiducial",              // 1
+    "Triggerred",            // 2
+    "Ecal BDT",              // 3
+    "N_{straight} < 3",      // 4
+    "PE_{HCal,max} < 8",       // 5
+    "N_{straight} = 0",      // 6
+    "Angle_{e,ph} > 3.",     // 7
+    };
+    if (!fiducial) labels.at(1) = "Non-fiducial";
+    break;
 
-  if (!fiducial_analysis_) labels_BDTCutFlow.at(1) = "Non-fiducial";
-  setHistLabels("BDTCutFlow_RecoilX",labels_BDTCutFlow);
+  // CutFlow labels for BDT with tracking
+  case kLabelsTracking:
+    labels = {
+    "All / Acceptance",      // 0
+    "Fiducial",              // 1
+    "Triggerred",            // 2
+    "p_{tagger} > 5600",     // 3
+    "N_{recoil} = 1",
+    "|d_{0}| < 10",
+    "|z_{0}| < 40",
+    "Ecal BDT",
+    "N_{straight} < 3",
+    "PE_{HCal,max} < 8",
+    "N_{straight} = 0",
+    "Angle_{e,ph} > 3.",     // 11
+    ""};
+    if (!fiducial) labels.at(6) = "Non-fiducial";
+    break;
+
+  // CutFlow labels for BDT with tracking with Hcal first
+  case kLabelsTrackingHcal:
+    labels = {
+    "All / Acceptance",
+    "Fiducial",              // 1
+    "Triggerred",            // 2
+    "PE_{HCal,max} < 8",       // 3
+    "Ecal BDT",            // 4
+    "N_{straight} = 0",      // 5
+    "Angle_{e,ph} > 3.",     // 6
+    "p_{tagger} > 5600",     // 7
+    "N_{recoil} = 1",  		 // 8
+    "|d_{0}| < 10",  		 // 9
+    "|z_{0}| < 40",  		 // 10
+    ""};
+    if (!fiducial) labels.at(1) = "Non-fiducial";
+    break;
 
   // // CutFlow labels for BDT with new lin-reg
-  // std::vector<std::string> labels_LinRegCutFlow = {
-  // "All",
-  // "Triggerred",            // 1
-  // "Fiducial",              // 2
-  // "Ecal BDT",            // 3
-  // "N_{straight} < 3",      // 4
-  // "PE_{HCal,max} < 8",       // 5
-  // "N_{straight} = 0",      // 6
-  // "N_{lin-reg} = 0",      // 7
-  // "Angle_{e,ph} > 3.",     // 8
-  // ""};
-
-  // if (!fiducial_analysis_) labels_LinRegCutFlow.at(2) = "Non-fiducial";
-  // setHistLabels("LinRegCutFlow_RecoilX",labels_LinRegCutFlow);
+  // case kLabelsLinReg:
+  //   labels = {
+  //   "All",
+  //   "Triggerred",            // 1
+  //   "Fiducial",              // 2
+  //   "Ecal BDT",            // 3
+  //   "N_{straight} < 3",      // 4
+  //   "PE_{HCal,max} < 8",       // 5
+  //   "N_{straight} = 0",      // 6
+  //   "N_{lin-reg} = 0",      // 7
+  //   "Angle_{e,ph} > 3.",     // 8
+  //   ""};
+  //   if (!fiducial) labels.at(2) = "Non-fiducial";
+  //   break;
 
   // // CutFlow labels for BDT with new lin-reg
-  // std::vector<std::string> labels_LinRegCutFlowHcal = {
-  // "All",
-  // "Triggerred",            // 1
-  // "PE_{HCal,max} < 8",       // 2
-  // "Fiducial",              // 3
-  // "Ecal BDT",            // 4
-  // "N_{straight} = 0",      // 5
-  // "N_{lin-reg} = 0",      // 6
-  // "Angle_{e,ph} > 3.",     // 7
-  // ""};
-
-  // if (!fiducial_analysis_) labels_LinRegCutFlowHcal.at(3) = "Non-fiducial";
-  // setHistLabels("LinRegCutFlowHcal_RecoilX",labels_LinRegCutFlowHcal);
+  // case kLabelsLinRegHcal:
+  //   labels = {
+  //   "All",
+  //   "Triggerred",            // 1
+  //   "PE_{HCal,max} < 8",       // 2
+  //   "Fiducial",              // 3
+  //   "Ecal BDT",            // 4
+  //   "N_{straight} = 0",      // 5
+  //   "N_{lin-reg} = 0",      // 6
+  //   "Angle_{e,ph} > 3.",     // 7
+  //   ""};
+  //   if (!fiducial) labels.at(3) = "Non-fiducial";
+  //   break;
+
+  case kNoLabels:
+    break;
+  }
+  return labels;
+}
 
-  // CutFlow labels for BDT with tracking
-  std::vector<std::string> labels_TrackingCutFlow = {
-  "All / Acceptance",      // 0
-  "Fiducial",              // 1
-  "Triggerred",            // 2
-  "p_{tagger} > 5600",     // 3
-  "N_{recoil} = 1",
-  "|d_{0}| < 10",
-  "|z_{0}| < 40",
-  "Ecal BDT",
-  "N_{straight} < 3",
-  "PE_{HCal,max} < 8",
-  "N_{straight} = 0",
-  "Angle_{e,ph} > 3.",     // 11
-  ""};
-
-  if (!fiducial_analysis_) labels_TrackingCutFlow.at(6) = "Non-fiducial";
-
-  setHistLabels("TrackingCutFlow_RecoilX",labels_TrackingCutFlow);
-  setHistLabels("Tracking_TaggerP",labels_TrackingCutFlow);
-  setHistLabels("Tracking_RecoilN",labels_TrackingCutFlow);
-  setHistLabels("Tracking_RecoilP",labels_TrackingCutFlow);
-  setHistLabels("Tracking_RecoilPt",labels_TrackingCutFlow);
-  setHistLabels("Tracking_RecoilD0",labels_TrackingCutFlow);
-  setHistLabels("Tracking_RecoilZ0",labels_TrackingCutFlow);
+TH2 *CutBasedDM::book(HistId id) {
+  const HistSpec &spec{histSpecs[id]};
+  // Histograms are booked from inside the event loop, keep gDirectory as it was
+  TDirectory::TContext ctx;
+  cdVariantDirectory();
+  // The helper is keyed by name, extra variants prefix theirs and rename the histogram
+  std::string key = variant_->name.empty() ? spec.name : variant_->name + "_" + spec.name;
+  const auto &[x, y]{binning_[id]};
+  histograms_.create(key, spec.xLabel, x.n, x.min, x.max, spec.yLabel, y.n, y.min, y.max);
+  auto histo{dynamic_cast<TH2 *>(histograms_.get(key))};
+  histo->SetName(spec.name);
+
+  std::vector<std::string> labels{getLabels(spec.xLabels, variant_->fiducial)};
+  for (std::size_t ibin{1}; ibin <= labels.size(); ibin++) {
+    histo->GetXaxis()->SetBinLabel(ibin, labels[ibin - 1].c_str());
+  }
+  labels = getLabels(spec.yLabels, variant_->fiducial);
+  for (std::size_t ibin{1}; ibin <= labels.size(); ibin++) {
+    histo->GetYaxis()->SetBinLabel(ibin, labels[ibin - 1].c_str());
+  }
 
-  // CutFlow labels for BDT with tracking with Hcal first
-  std::vector<std::string> labels_TrackingCutFlowHcal = {
-  "All / Acceptance",
-  "Fiducial",              // 1
-  "Triggerred",            // 2
-  "PE_{HCal,max} < 8",       // 3
-  "Ecal BDT",            // 4
-  "N_{straight} = 0",      // 5
-  "Angle_{e,ph} > 3.",     // 6
-  "p_{tagger} > 5600",     // 7
-  "N_{recoil} = 1",  		 // 8
-  "|d_{0}| < 10",  		 // 9
-  "|z_{0}| < 40",  		 // 10
-  ""};
-  if (!fiducial_analysis_) labels_TrackingCutFlowHcal.at(1) = "Non-fiducial";
-  setHistLabels("TrackingCutFlowHcal_RecoilX",labels_TrackingCutFlowHcal);
-  setHistLabels("TrackingHcal_TaggerP",labels_TrackingCutFlowHcal);
-  setHistLabels("TrackingHcal_RecoilN",labels_TrackingCutFlowHcal);
-  setHistLabels("TrackingHcal_RecoilD0",labels_TrackingCutFlowHcal);
-  setHistLabels("TrackingHcal_RecoilZ0",labels_TrackingCutFlowHcal);
-
-} 
-
-void CutBasedDM::analyze(const framework::Event& event) {
+  variant_->hists[id] = histo;
+  return histo;
+}
+
+void CutBasedDM::cdVariantDirectory() {
+  TDirectory *dir{getHistoDirectory()};
+  if (variant_->name.empty()) return;
+  TDirectory *sub{dir->GetDirectory(variant_->name.c_str())};
+  if (!sub) sub = dir->mkdir(variant_->name.c_str());
+  sub->cd();
+}
+
+void CutBasedDM::fillSketches(int stage, const double *features) {
+  for (std::size_t ivar{0}; ivar < quantileVars_.size(); ivar++) {
+    // -9999 and below are "not available" defaults, not values
+    double value{features[quantileVars_[ivar]]};
+    if (value <= -9999. || !std::isfinite(value)) continue;
+    TH1 *&sketch{variant_->sketches[ivar * kNSketchStages + stage]};
+    if (!sketch) {
+      // Bucket counts as a plain TH1D, so sketches from several jobs merge with hadd
+      TDirectory::TContext ctx;
+      cdVariantDirectory();
+      std::string name = std::string("Quantile_") + featureNames[quantileVars_[ivar]] + "_CnC" + std::to_string(stage);
+      std::string key = variant_->name.empty() ? name : variant_->name + "_" + name;
+      int nBuckets = sketchLayout_.nBuckets();
+      histograms_.create(key, "Sketch bucket", nBuckets, -0.5, nBuckets - 0.5);
+      sketch = histograms_.get(key);
+      sketch->SetName(name.c_str());
+      sketch->SetTitle(sketchLayout_.title().c_str());
+    }
+    sketch->Fill(sketchLayout_.index(value), weight_);
+  }
+}
+
+void CutBasedDM::evaluateCut(const AnalysisVariant &variant, CutId cut, uint8_t *pass) const {
+  const int n{blockSize_};
+  if (!cutApplies(cut, variant.fiducial, variant.ignoreFiducial, variant.ignoreTagger)) {
+    std::fill(pass, pass + n, 1);
+    return;
+  }
+  // Same tests as passesCut(), one loop per kind of test
+  const double *x{block_[cutSpecs[cut].feature].data()};
+  const double value{cutValue(cut, variant.fiducial)};
+  switch (cutSpecs[cut].test) {
+  case tEqual: for (int e = 0; e < n; e++) pass[e] = x[e] == value; break;
+  case tBelow: for (int e = 0; e < n; e++) pass[e] = x[e] < value; break;
+  case tAbove: for (int e = 0; e < n; e++) pass[e] = x[e] > value; break;
+  case tAbsBelow: for (int e = 0; e < n; e++) pass[e] = fabs(x[e]) < value; break;
+  }
+}
+
+void CutBasedDM::fillStages(HistId id, const uint8_t *nPassed, const double *y) {
+  // Same (x, y, w) sequence as the per-event fills, event by event, so the
+  // histogram contents and statistics come out identical
+  stageXs_.clear();
+  stageYs_.clear();
+  stageWs_.clear();
+  for (int e = 0; e < blockSize_; e++) {
+    for (int i = 0; i < nPassed[e]; i++) {
+      stageXs_.push_back(i);
+      stageYs_.push_back(y[e]);
+      stageWs_.push_back(blockWeights_[e]);
+    }
+  }
+  if (stageXs_.empty()) return;
+  fillN(id, stageXs_.size(), stageXs_.data(), stageYs_.data(), stageWs_.data());
+}
+
+void CutBasedDM::processBlock() {
+  const int n{blockSize_};
+  const double *w{blockWeights_.data()};
+  std::vector<uint8_t> cutPassed(kNCuts * n);
+  std::vector<uint8_t> passedSoFar(n);
+  std::vector<uint8_t> nPassed[kNCutFlows];
+  std::vector<double> xs, ys;
+
+  // fill() follows variant_, restored afterwards
+  AnalysisVariant *current{variant_};
+  for (auto &variant : variants_) {
+    variant_ = &variant;
+
+    for (int cut = 0; cut < kNCuts; cut++) evaluateCut(variant, CutId(cut), &cutPassed[cut * n]);
+    if (!cut_record_file_.empty()) {
+      // The block's events are the last n records
+      const size_t recordSize{2 + variants_.size()};
+      uint32_t *mask{&cutRecords_[cutRecords_.size() - n * recordSize + 2 + (variant_ - variants_.data())]};
+      for (int e = 0; e < n; e++) {
+        for (int cut = 0; cut < kNCuts; cut++) mask[e * recordSize] |= uint32_t(cutPassed[cut * n + e]) << cut;
+      }
+    }
+
+    // Number of leading cuts passed per event and cut flow
+    for (int flow = 0; flow < kNCutFlows; flow++) {
+      const auto &cuts{cutFlowSpecs[flow].cuts};
+      nPassed[flow].assign(n, 0);
+      std::fill(passedSoFar.begin(), passedSoFar.end(), 1);
+      uint8_t *count{nPassed[flow].data()};
+      uint8_t *alive{passedSoFar.data()};
+      for (CutId cut : cuts) {
+        const uint8_t *pass{&cutPassed[cut * n]};
+        for (int e = 0; e < n; e++) {
+          alive[e] &= pass[e];
+          count[e] += alive[e];
+        }
+      }
+      if (!metrics_file_.empty() || bootstrapFlows_[flow]) {
+        for (int e = 0; e < n; e++) {
+          weight_ = w[e];
+          replicaWeights_ = blockReplicaWeights_.data() + e * bootstrap_replicas_;
+          countStages(CutFlow(flow), cuts.size(), count[e]);
+        }
+      }
+      if (patternFlows_[flow]) {
+        for (int e = 0; e < n; e++) {
+          uint32_t pattern{0};
+          for (std::size_t i = 0; i < cuts.size(); i++) pattern |= uint32_t(cutPassed[cuts[i] * n + e]) << i;
+          weight_ = w[e];
+          fillPattern(CutFlow(flow), pattern, patternVariable_ != kNFeatures ? block_[patternVariable_][e] : 0.);
+        }
+      }
+    }
+
+    // Trigger eff curves
+    xs.assign(block_[fTrigger].begin(), block_[fTrigger].begin() + n);
+    ys.resize(n);
+    for (int e = 0; e < n; e++) ys[e] = 8000. - block_[fSummedDet][e];
+    fillN(hTrigEffVsMissingE, n, xs.data(), ys.data(), w);
+    fillN(hTrigEffVsRecoilPTAtTarget, n, xs.data(), block_[fTruthPTAtTarget].data(), w);
+
+    for (int e = 0; e < n; e++) {
+      weight_ = w[e];
+      int flag = block_[fAcceptanceFlag][e];
+      double recoilX{block_[fRecoilX][e]};
+      if (flag > 0) {
+        fill(hAcceptance, 0. , recoilX );
+        if (flag & (1 << 0)) fill(hAcceptance, 1. , recoilX );
+        if (flag & (1 << 1)) fill(hAcceptance, 2. , recoilX );
+        if (flag & (1 << 2)) fill(hAcceptance, 3. , recoilX );
+        if (flag & (1 << 3)) fill(hAcceptance, 4. , recoilX );
+        if (block_[fAcceptance][e] != 0.) fill(hAcceptance, 5. , recoilX );
+      }
+    }
+
+    for (int flow = 0; flow < kNCutFlows; flow++) {
+      for (const auto &stageFill : cutFlowSpecs[flow].fills) {
+        fillStages(stageFill.id, nPassed[flow].data(), block_[stageFill.y].data());
+      }
+    }
+
+    // CnC extras: sketches per stage, BDT vs HCAL before and after the ECAL cuts
+    const uint8_t *nCnC{nPassed[kFlowCnC].data()};
+    double features[kNFeatures];
+    for (int e = 0; e < n; e++) {
+      if (quantileVars_.empty() && nCnC[e] < 2) continue;
+      weight_ = w[e];
+      for (int f = 0; f < kNFeatures; f++) features[f] = block_[f][e];
+      for (int i = 0; i < nCnC[e]; i++) {
+        fillSketches(i, features);
+        if (i==1) {
+          fill(hBDTDiscrVsHcalPE_PreS, features[fHcalMaxPE] , features[fBDTDisc] );
+          fill(hBDTDiscrLogVsHcalPE_PreS, features[fHcalMaxPE] , features[fBDTDiscLog] );
+        }
+        if (i==10) {
+          fill(hBDTDiscrVsHcalPE_PostS, features[fHcalMaxPE] , features[fBDTDisc] );
+          fill(hBDTDiscrLogVsHcalPE_PostS, features[fHcalMaxPE] , features[fBDTDiscLog] );
+        }
+      }
+    }
+
+    if (!signal_) {
+      for (int e = 0; e < n; e++) {
+        if (nPassed[kFlowTracking][e] == cutFlowSpecs[kFlowTracking].cuts.size()) {
+          ldmx_log(debug) << "This bkg event survived all the cuts";
+        }
+      }
+    }
+  }
+  variant_ = current;
+  blockSize_ = 0;
+}
+
+// Only the last process on the node to finish books the histograms, with the
+// contents accumulated by all of them
+void CutBasedDM::writeSharedHistograms() {
+  if (!sharedStore_->finish(nEvents_)) {
+    ldmx_log(info) << "Histograms left in shared memory " << shared_histograms_ << " for the last process to write";
+    sharedStore_.reset();
+    return;
+  }
+  AnalysisVariant *current{variant_};
+  for (std::size_t v = 0; v < variants_.size(); v++) {
+    variant_ = &variants_[v];
+    for (int id = 0; id < kNHists; id++) {
+      const int region = v * kNHists + id;
+      if (sharedStore_->entries(region) == 0) continue;
+      TH2 *histo{book(HistId(id))};
+      const auto &r{sharedStore_->region(region)};
+      const bool weighted{sharedStore_->weighted(region)};
+      const double *sumw{sharedStore_->sumw(region)};
+      const double *sumw2{sharedStore_->sumw2(region)};
+      if (weighted) histo->Sumw2();
+      // Also when booked with errors (e.g. TH1::SetDefaultSumw2), where
+      // SetBinContent() would leave them at 0
+      const bool errors{histo->GetSumw2N() > 0};
+      for (int bin = 0; bin < (r.x.n + 2) * (r.y.n + 2); bin++) {
+        histo->SetBinContent(bin, sumw[bin]);
+        if (errors) histo->SetBinError(bin, sqrt(sumw2[bin]));
+      }
+      double stats[SharedHistogramStore::kNStats];
+      std::copy_n(sharedStore_->stats(region), SharedHistogramStore::kNStats, stats);
+      histo->PutStats(stats);
+      histo->SetEntries(sharedStore_->entries(region));
+    }
+  }
+  variant_ = current;
+
+  // Who contributed, a crashed process' fills up to its crash are included
+  std::ostringstream table;
+  uint64_t events{0};
+  for (const auto &p : sharedStore_->participants()) {
+    bool done{p.state == SharedHistogramStore::kDone};
+    table << p.pid << " " << p.events << " " << (done ? "done" : "crashed") << "\n";
+    events += p.events;
+    if (!done) ldmx_log(warn) << "Process " << p.pid << " sharing " << shared_histograms_ << " did not finish";
+  }
+  {
+    TDirectory::TContext ctx;
+    getHistoDirectory();
+    TObjString participants(table.str().c_str());
+    participants.Write("SharedHistogramParticipants");
+  }
+  ldmx_log(info) << "Wrote the shared histograms " << shared_histograms_ << " of " << sharedStore_->participants().size()
+                 << " processes, " << events << " events";
+  sharedStore_->release();
+  sharedStore_.reset();
+}
+
+// Text header, then fixed size little-endian records sorted by (run, event):
+//   uint64 run << 32 | event, uint32 mask of passed cuts per variant
+// where bit i of a mask is cutSpecs[i].name
+void CutBasedDM::writeCutRecords() {
+  const size_t recordSize{2 + variants_.size()};
+  const size_t n{cutRecords_.size() / recordSize};
+  std::vector<uint64_t> keys(n);
+  for (size_t i = 0; i < n; i++) keys[i] = uint64_t(cutRecords_[i * recordSize]) << 32 | cutRecords_[i * recordSize + 1];
+  std::vector<size_t> order(n);
+  for (size_t i = 0; i < n; i++) order[i] = i;
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return keys[a] < keys[b]; });
+
+  FILE *out = fopen(cut_record_file_.c_str(), "wb");
+  if (!out) {
+    ldmx_log(error) << "Cannot write the cut record file " << cut_record_file_;
+    return;
+  }
+  fprintf(out, "CUTRECORD 1\ncuts");
+  for (const auto &cut : cutSpecs) fprintf(out, " %s", cut.name);
+  fprintf(out, "\n");
+  for (int flow = 0; flow < kNCutFlows; flow++) {
+    fprintf(out, "flow %s", cutFlowNames[flow]);
+    for (CutId cut : cutFlowSpecs[flow].cuts) fprintf(out, " %s", cutSpecs[cut].name);
+    fprintf(out, "\n");
+  }
+  fprintf(out, "variants");
+  for (const auto &variant : variants_) fprintf(out, " %s", variant.name.empty() ? "nominal" : variant.name.c_str());
+  fprintf(out, "\nrecords %zu\n", n);
+  for (size_t i : order) {
+    fwrite(&keys[i], sizeof(uint64_t), 1, out);
+    fwrite(&cutRecords_[i * recordSize + 2], sizeof(uint32_t), variants_.size(), out);
+  }
+  fclose(out);
+  ldmx_log(info) << "Wrote " << n << " cut records to " << cut_record_file_;
+}
+
+// The title lists the cuts by bit, for cutPatterns.py
+void CutBasedDM::fillPattern(CutFlow flow, uint32_t pattern, double value) {
+  TH1 *counts{variant_->patterns[flow]};
+  if (!counts) {
+    TDirectory::TContext ctx;
+    cdVariantDirectory();
+    const auto &cuts{cutFlowSpecs[flow].cuts};
+    std::string title{"Pass pattern:"};
+    for (CutId cut : cuts) title += std::string(" ") + cutSpecs[cut].name;
+    const int nPatterns{1 << cuts.size()};
+    std::string name{std::string("Pattern_") + cutFlowNames[flow]};
+    counts = new TH1D(name.c_str(), title.c_str(), nPatterns, -0.5, nPatterns - 0.5);
+    variant_->patterns[flow] = counts;
+    if (patternVariable_ != kNFeatures) {
+      name += std::string("_vs_") + featureNames[patternVariable_];
+      variant_->patternsVsVariable[flow] = new TH2D(name.c_str(), title.c_str(), nPatterns, -0.5, nPatterns - 0.5, pattern_variable_bins_,
+                                                    pattern_variable_min_, pattern_variable_max_);
+      variant_->patternsVsVariable[flow]->GetYaxis()->SetTitle(featureNames[patternVariable_]);
+    }
+  }
+  counts->Fill(pattern, weight_);
+  if (variant_->patternsVsVariable[flow]) variant_->patternsVsVariable[flow]->Fill(pattern, value, weight_);
+}
+
+void CutBasedDM::writeReplicas() {
+  // Stage x replica counts as a TH2D per cut flow: sums of event weights,
+  // so outputs of several jobs add up with hadd
+  const int n{bootstrap_replicas_};
+  for (auto &variant : variants_) {
+    variant_ = &variant;
+    for (int flow = 0; flow < kNCutFlows; flow++) {
+      const auto &replicas{variant.replicas[flow]};
+      if (replicas.empty()) continue;
+      int nStages = replicas.size() / n;
+      TDirectory::TContext ctx;
+      cdVariantDirectory();
+      std::string name = std::string("Bootstrap_") + cutFlowNames[flow];
+      auto histo{new TH2D(name.c_str(), "Poisson bootstrap replicas", nStages, -0.5, nStages - 0.5, n, -0.5, n - 0.5)};
+      histo->GetXaxis()->SetTitle("Cut flow stage");
+      histo->GetYaxis()->SetTitle("Replica");
+      std::vector<std::string> labels{getLabels(cutFlowLabels[flow], variant.fiducial)};
+      for (int i = 0; i < nStages; i++) {
+        if (i < (int)labels.size()) histo->GetXaxis()->SetBinLabel(i + 1, labels[i].c_str());
+        for (int r = 0; r < n; r++) histo->SetBinContent(i + 1, r + 1, replicas[i * n + r]);
+      }
+      histo->SetEntries(nEvents_ - nSampledOut_);
+    }
+  }
+}
+
+// An axis is adapted if it holds a variable, not stages / categories
+static bool adaptiveAxis(int nBins, LabelSet labels) { return labels == kNoLabels && nBins > 10; }
+
+void CutBasedDM::endWarmup() {
+  warmingUp_ = false;
+  std::vector<std::vector<double>> xs(kNHists), ys(kNHists);
+  for (const auto &record : warmupFills_) {
+    xs[record.id].push_back(record.x);
+    ys[record.id].push_back(record.y);
+  }
+  double bytes{0.};
+  for (int id = 0; id < kNHists; id++) {
+    const HistSpec &spec{histSpecs[id]};
+    auto &[x, y]{binning_[id]};
+    if (adaptiveAxis(spec.nX, spec.xLabels)) x = deriveAxisBinning(xs[id], x);
+    if (adaptiveAxis(spec.nY, spec.yLabels)) y = deriveAxisBinning(ys[id], y);
+    // TH2F contents plus sum of weights squared, for every variant
+    bytes += (x.n + 2.) * (y.n + 2.) * 12. * variants_.size();
+  }
+  // Give the adapted axes fewer bins if the histograms would not fit the budget
+  if (bytes > adaptive_memory_mb_ * 1.e6) {
+    double factor = adaptive_memory_mb_ * 1.e6 / bytes;
+    for (int id = 0; id < kNHists; id++) {
+      const HistSpec &spec{histSpecs[id]};
+      bool adaptX{adaptiveAxis(spec.nX, spec.xLabels)}, adaptY{adaptiveAxis(spec.nY, spec.yLabels)};
+      double axisFactor = adaptX && adaptY ? sqrt(factor) : factor;
+      if (adaptX) binning_[id].first = shrinkAxisBinning(binning_[id].first, axisFactor);
+      if (adaptY) binning_[id].second = shrinkAxisBinning(binning_[id].second, axisFactor);
+    }
+  }
+  ldmx_log(info) << "Adaptive binning from " << warmupFills_.size() << " buffered fills:\n" << binningTable();
+
+  // Replay in the original order
+  AnalysisVariant *current{variant_};
+  double weight{weight_};
+  for (const auto &record : warmupFills_) {
+    variant_ = &variants_[record.variant];
+    weight_ = record.w;
+    fill(HistId(record.id), record.x, record.y);
+  }
+  variant_ = current;
+  weight_ = weight;
+  warmupFills_.clear();
+  warmupFills_.shrink_to_fit();
+}
+
+// One line per histogram: name nX xMin xMax nY yMin yMax
+std::string CutBasedDM::binningTable() const {
+  std::ostringstream table;
+  table.precision(17);
+  for (int id = 0; id < kNHists; id++) {
+    const auto &[x, y]{binning_[id]};
+    table << histSpecs[id].name << " " << x.n << " " << x.min << " " << x.max << " " << y.n << " " << y.min << " " << y.max << "\n";
+  }
+  return table.str();
+}
+
+void CutBasedDM::loadBinning(const std::string &fileName) {
+  std::unique_ptr<TFile> file{TFile::Open(fileName.c_str())};
+  auto table{file ? file->Get<TObjString>((getName() + "/AdaptiveBinning").c_str()) : nullptr};
+  if (!table) {
+    EXCEPTION_RAISE("BadConf", "No " + getName() + "/AdaptiveBinning in " + fileName);
+  }
+  std::istringstream lines(table->GetName());
+  std::string name;
+  AxisBinning x, y;
+  while (lines >> name >> x.n >> x.min >> x.max >> y.n >> y.min >> y.max) {
+    for (int id = 0; id < kNHists; id++) {
+      if (name == histSpecs[id].name) binning_[id] = {x, y};
+    }
+  }
+  ldmx_log(info) << "Binning read from " << fileName;
+}
+
+void CutBasedDM::onProcessStart(){
+  getHistoDirectory();
+
+  for (const auto &[coll, pass] : inputs_) {
+    ldmx_log(info) << "Input: " << coll << "_" << (pass.empty() ? "*" : pass);
+  }
+
+  // Histograms are booked on their first fill, see book()
+  binning_.clear();
+  for (const auto &spec : histSpecs) {
+    binning_.push_back({{spec.nX, spec.xMin, spec.xMax}, {spec.nY, spec.yMin, spec.yMax}});
+  }
+  if (!adaptive_binning_file_.empty()) {
+    loadBinning(adaptive_binning_file_);
+  } else if (adaptive_binning_) {
+    warmingUp_ = true;
+  }
+  if (!shared_histograms_.empty()) {
+    std::vector<SharedHistogramStore::Region> regions;
+    std::string layout;
+    for (const auto &variant : variants_) {
+      layout += variant.name + ";";
+      for (const auto &[x, y] : binning_) regions.push_back({{x.n, x.min, x.max}, {y.n, y.min, y.max}});
+    }
+    try {
+      sharedStore_ = std::make_unique<SharedHistogramStore>(shared_histograms_, regions, layout);
+    } catch (const std::runtime_error &e) {
+      EXCEPTION_RAISE("BadConf", e.what());
+    }
+  } else if (async_fill_buffer_ > 0) {
+    asyncFiller_ = std::make_unique<AsyncFiller<TH2>>(async_fill_buffer_);
+  }
+  if (!feature_stream_.empty()) {
+    std::vector<std::string> columns(std::begin(featureNames), std::end(featureNames));
+    columns.push_back("Weight");
+    try {
+      featureStream_ = std::make_unique<FeatureStream>(feature_stream_, columns);
+    } catch (const std::runtime_error &e) {
+      EXCEPTION_RAISE("BadConf", e.what());
+    }
+  }
+  for (auto &variant : variants_) {
+    if (!variant.name.empty()) {
+      ldmx_log(info) << "Variant " << variant.name << ": fiducial_analysis = " << variant.fiducial
+                     << ", ignore_fiducial_analysis = " << variant.ignoreFiducial
+                     << ", ignore_tagger_analysis = " << variant.ignoreTagger;
+    }
+    variant.hists.assign(kNHists, nullptr);
+    variant.sketches.assign(quantileVars_.size() * kNSketchStages, nullptr);
+  }
+  if (batch_size_ > 0) {
+    block_.assign(kNFeatures, std::vector<double>(batch_size_));
+    blockWeights_.assign(batch_size_, 1.);
+    blockReplicaWeights_.assign(batch_size_ * bootstrap_replicas_, 0);
+  }
+  eventReplicaWeights_.assign(bootstrap_replicas_, 0);
+  replicaWeights_ = eventReplicaWeights_.data();
+
+  startTime_ = lastMetricsTime_ = std::chrono::steady_clock::now();
+  if (!metrics_file_.empty()) writeMetrics();
+}
+
+// Prometheus label values escape backslash, quote and newline
+static std::string metricLabel(const std::string &value) {
+  std::string escaped;
+  for (char c : value) {
+    if (c == '\\' || c == '"') escaped += '\\';
+    if (c == '\n') {
+      escaped += "\\n";
+      continue;
+    }
+    escaped += c;
+  }
+  return escaped;
+}
+
+void CutBasedDM::writeMetrics() {
+  auto now{std::chrono::steady_clock::now()};
+  double sinceLast = std::chrono::duration<double>(now - lastMetricsTime_).count();
+  double rate = sinceLast > 0. ? (nEvents_ - lastMetricsEvents_) / sinceLast : 0.;
+  lastMetricsTime_ = now;
+  lastMetricsEvents_ = nEvents_;
+
+  long rssPages{0};
+  if (FILE *statm = fopen("/proc/self/statm", "r")) {
+    long size;
+    if (fscanf(statm, "%ld %ld", &size, &rssPages) != 2) rssPages = 0;
+    fclose(statm);
+  }
+
+  // Written next to the target and renamed over it, readers never see a partial file
+  std::string tmpName = metrics_file_ + ".tmp";
+  FILE *out = fopen(tmpName.c_str(), "w");
+  if (!out) {
+    ldmx_log(warn) << "Could not write the metrics file " << tmpName;
+    return;
+  }
+  fprintf(out, "# HELP cutbased_events_total Events seen by CutBasedDM\n");
+  fprintf(out, "# TYPE cutbased_events_total counter\n");
+  fprintf(out, "cutbased_events_total %ld\n", nEvents_);
+  fprintf(out, "# HELP cutbased_events_sampled_out_total Events skipped by the sub-sampling\n");
+  fprintf(out, "# TYPE cutbased_events_sampled_out_total counter\n");
+  fprintf(out, "cutbased_events_sampled_out_total %ld\n", nSampledOut_);
+  fprintf(out, "# HELP cutbased_events_per_second Event rate since the previous update\n");
+  fprintf(out, "# TYPE cutbased_events_per_second gauge\n");
+  fprintf(out, "cutbased_events_per_second %g\n", rate);
+  fprintf(out, "# HELP cutbased_uptime_seconds Time since the start of processing\n");
+  fprintf(out, "# TYPE cutbased_uptime_seconds gauge\n");
+  fprintf(out, "cutbased_uptime_seconds %g\n", std::chrono::duration<double>(now - startTime_).count());
+  fprintf(out, "# HELP cutbased_resident_memory_bytes Resident set size of the job\n");
+  fprintf(out, "# TYPE cutbased_resident_memory_bytes gauge\n");
+  fprintf(out, "cutbased_resident_memory_bytes %ld\n", rssPages * sysconf(_SC_PAGESIZE));
+  fprintf(out, "# HELP cutbased_input_file Input file being processed\n");
+  fprintf(out, "# TYPE cutbased_input_file gauge\n");
+  fprintf(out, "cutbased_input_file{file=\"%s\"} 1\n", metricLabel(currentInputFile_).c_str());
+  fprintf(out, "# HELP cutbased_cutflow_passed_total Events passing all cuts of a cut flow up to a stage\n");
+  fprintf(out, "# TYPE cutbased_cutflow_passed_total counter\n");
+  for (const auto &variant : variants_) {
+    for (int flow = 0; flow < kNCutFlows; flow++) {
+      auto labels{getLabels(cutFlowLabels[flow], variant.fiducial)};
+      for (size_t i=0;i<variant.passCounts[flow].size();i++) {
+        fprintf(out, "cutbased_cutflow_passed_total{variant=\"%s\",flow=\"%s\",stage=\"%zu\",cut=\"%s\"} %ld\n",
+                metricLabel(variant.name).c_str(), cutFlowNames[flow], i,
+                metricLabel(i < labels.size() ? labels[i] : "").c_str(), variant.passCounts[flow][i]);
+      }
+    }
+  }
+  bool ok = ferror(out) == 0;
+  ok = (fclose(out) == 0) && ok;
+  if (!ok || rename(tmpName.c_str(), metrics_file_.c_str()) != 0) {
+    ldmx_log(warn) << "Could not write the metrics file " << metrics_file_;
+  }
+}
+
+void CutBasedDM::analyze(const framework::Event& event) { (this->*eventKernel_)(event); }
+
+template <bool kSignal, bool kLoadTagger>
+void CutBasedDM::analyzeEvent(const framework::Event& event) {
   //std::cout << " ---------------------------------------------" << std::endl;
-  auto vetoNew{event.getObject<ldmx::EcalVetoResult>("EcalVetoNew","")};
+  nEvents_++;
+  // Only look at the clock every 256 events
+  if (!metrics_file_.empty() && (nEvents_ & 255) == 0 &&
+      std::chrono::steady_clock::now() - lastMetricsTime_ > std::chrono::duration<double>(metrics_period_s_)) {
+    writeMetrics();
+  }
+  // Keep in sync with inputs_ in configure()
   auto trigResult{event.getObject<ldmx::TriggerResult>(trigger_collName_, trigger_passName_)};
-  auto hcalVeto{event.getObject<ldmx::HcalVetoResult>("HcalVeto","cutbased")};
-  auto hcalRecHits{event.getCollection<ldmx::HcalHit>("HcalRecHits", "")};
-  auto targetSpHits{event.getCollection<ldmx::SimTrackerHit>("TargetScoringPlaneHits",sp_pass_name_)};
-  auto recoilTrackCollection{event.getCollection<ldmx::Track>(recoil_track_collection_)};
-  std::vector<ldmx::Track> taggerTrackCollection;
-  if (!ignore_tagger_analysis_) {
-    taggerTrackCollection = event.getCollection<ldmx::Track>("TaggerTracks","cutbased");
+
+  // Sub-sampling, decided before anything else is loaded. Triggered events
+  // form their own stratum and are all kept with unit weight.
+  weight_ = 1.;
+  if (sample_fraction_ < 1.) {
+    if (!(sample_keep_triggered_ && trigResult.passed())) {
+      const auto &header{event.getEventHeader()};
+      double u = (eventHash(header.getRun(), header.getEventNumber(), sample_seed_) >> 11) * 0x1.0p-53;
+      if (u >= sample_fraction_) {
+        nSampledOut_++;
+        return;
+      }
+      weight_ = 1. / sample_fraction_;
+    }
+  }
+
+  if (warmingUp_ && (nEvents_ - nSampledOut_ > adaptive_warmup_events_ ||
+                     warmupFills_.size() * sizeof(FillRecord) > adaptive_buffer_mb_ * 1.e6)) {
+    // The binning comes from the fills of all the warm-up events, also those
+    // still waiting in the block
+    if (blockSize_ > 0) {
+      double weight{weight_};
+      processBlock();
+      weight_ = weight;
+    }
+    endWarmup();
+  }
+
+  if (bootstrap_replicas_ > 0) {
+    const auto &header{event.getEventHeader()};
+    uint8_t *draws{batch_size_ > 0 ? &blockReplicaWeights_[blockSize_ * bootstrap_replicas_] : eventReplicaWeights_.data()};
+    drawPoisson1(eventHash(header.getRun(), header.getEventNumber(), bootstrap_seed_), bootstrap_replicas_, draws);
   }
 
+  auto vetoNew{event.getObject<ldmx::EcalVetoResult>(ecal_veto_collName_, ecal_veto_passName_)};
+  auto hcalVeto{event.getObject<ldmx::HcalVetoResult>(hcal_veto_collName_, hcal_veto_passName_)};
+  auto hcalRecHits{event.getCollection<ldmx::HcalHit>("HcalRecHits", hcal_rechits_passName_)};
+  auto recoilTrackCollection{event.getCollection<ldmx::Track>(recoil_track_collection_, track_pass_name_)};
+
   bool acceptance{true};
   int fiducial_analysis_flag{-1};
-  if (signal_) {
+  if constexpr (kSignal) {
     auto acceptanceChecks{event.getObject<ldmx::FiducialFlag>("RecoilTruthFiducialFlags")};
     acceptance =  acceptanceChecks.isFiducial();
     fiducial_analysis_flag = acceptanceChecks.getFiducialFlag();
   }
 
-  // Take recoil momentum from SIM particles
-  float pT{-9999.};
-  float pZ{-9999.};
-  float totMom{-9999.};
-  auto particleMap{event.getMap<int, ldmx::SimParticle>("SimParticles")};
-  auto [recoilTrackID, recoilElectron] = CutBasedDM::getRecoilEle(particleMap);
-  pT =   sqrt(recoilElectron->getMomentum()[0] * recoilElectron->getMomentum()[0] +  recoilElectron->getMomentum()[1] * recoilElectron->getMomentum()[1]);
-  pZ = recoilElectron->getMomentum()[2];
-  totMom = sqrt(pT*pT + pZ*pZ);
-
-  // auto phiEle =   (180/M_PI)*std::acos(recoilElectron->getMomentum()[1] /totMom)-90.;
-  // auto thetaEle = (180/M_PI)*std::acos(pZ/totMom);
-
-  //  Same but at the target SP
-  float XAtTarget{-9999};
-  float pTAtTarget{-9999.};
-  float pYAtTarget{-9999.};
-  float pZAtTarget{-9999.};
-  float totMomAtTarget{-9999.};
-  for (ldmx::SimTrackerHit &spHit : targetSpHits) {
-    ldmx::SimSpecialID hit_id(spHit.getID());
-    if (hit_id.plane() != 1 || spHit.getMomentum()[2] <= 0) continue;
-
-    if (spHit.getTrackID() == recoilTrackID) {
-      float p_current = sqrt(spHit.getMomentum()[0]*spHit.getMomentum()[0] + spHit.getMomentum()[1]*spHit.getMomentum()[1] + spHit.getMomentum()[2]*spHit.getMomentum()[2]);
-      if (p_current > totMomAtTarget) {
-        pYAtTarget  = spHit.getMomentum()[1];
-        pTAtTarget = sqrt(spHit.getMomentum()[0]*spHit.getMomentum()[0] + spHit.getMomentum()[1]*spHit.getMomentum()[1]);
-        pZAtTarget = spHit.getMomentum()[2];
-        totMomAtTarget = p_current;
-        XAtTarget = spHit.getPosition()[0];
-      }
-    }
+  // Recoil truth kinematics: from the compact summary if it was produced
+  // upstream, otherwise from the full SimParticles and Target SP hits
+  std::vector<float> truthRecoil;
+  if (!truth_summary_collection_.empty() && event.exists(truth_summary_collection_, truth_summary_pass_)) {
+    truthRecoil = event.getCollection<float>(truth_summary_collection_, truth_summary_pass_);
+  } else {
+    auto particleMap{event.getMap<int, ldmx::SimParticle>("SimParticles")};
+    auto targetSpHits{event.getCollection<ldmx::SimTrackerHit>("TargetScoringPlaneHits",sp_pass_name_)};
+    truthRecoil = computeTruthRecoilSummary(particleMap, targetSpHits);
   }
-  //std::cout << " pYAtTarget " <<  pYAtTarget << " totMomAtTarget " << totMomAtTarget << std::endl ;
-  auto phiEleAtTarget =   (180/M_PI)*std::acos(pYAtTarget/totMomAtTarget)-90.;
-  auto thetaEleAtTarget = (180/M_PI)*std::acos(pZAtTarget/totMomAtTarget);
-  // //std::cout << " phiEleAtTarget " << phiEleAtTarget << " phiEle " << phiEle
-  //  //std::cout << " thetaEleAtTarget " << thetaEleAtTarget << " phiEleAtTarget " << phiEleAtTarget << std::endl;
+  float pT = truthRecoil.at(kTruthPT);
+  float pZ = truthRecoil.at(kTruthPZ);
+  float totMom = truthRecoil.at(kTruthP);
+  float XAtTarget = truthRecoil.at(kTruthXAtTarget);
+  float pTAtTarget = truthRecoil.at(kTruthPTAtTarget);
+  float pZAtTarget = truthRecoil.at(kTruthPZAtTarget);
+  float totMomAtTarget = truthRecoil.at(kTruthPAtTarget);
+  float thetaEleAtTarget = truthRecoil.at(kTruthThetaAtTarget);
+  float phiEleAtTarget = truthRecoil.at(kTruthPhiAtTarget);
 
   // Take recoil momentum from ECAL SP
   // pT2 = vetoNew.getRecoilMomentum()[0]*vetoNew.getRecoilMomentum()[0] + vetoNew.getRecoilMomentum()[1]*vetoNew.getRecoilMomentum()[1];
@@ -589,48 +1939,185 @@ void CutBasedDM::analyze(const framework::Event& event) {
   hcalMaxTiming = maxPEHit->getTime();
   hcalMaxSector =  maxPeId.section();
 
+  // --------------------------------------------------------------------------
+  // Calculate tracking variables if tracking is available
+  //std::cout << " Tracking variables = " << std::endl;
+  float taggerP{0.0}; // Make sure this is in MeV!!
+  // Start with tagger tracks, not even loaded if every variant ignores them
+  if constexpr (kLoadTagger) {
+    auto taggerTrackCollection{event.getCollection<ldmx::Track>(tagger_track_collection_, tagger_track_passName_)};
+    auto taggerN = taggerTrackCollection.size();
+    // std::cout << " taggerN = " << taggerN << std::endl;
+    if (taggerN == 1) {
+      for (const auto trk : taggerTrackCollection) {
+        auto QoP = trk.getQoP();
+        taggerP = 1000. / std::abs(QoP);
+      }
+    }
+  }
+
+  // Recoil tracks now
+  float recoilP{0.0}; // Make sure this is in MeV!!
+  float recoilPt{0.0}; // Make sure this is in MeV!!
+  float recoilD0{-9999.};
+  float recoilZ0{-9999.};
+  auto recoilN = recoilTrackCollection.size();
+  //std::cout << " recoilN = " << recoilN << std::endl;
+  if (recoilN == 1) {
+    for (const auto trk : recoilTrackCollection) {
+      recoilD0 = trk.getD0();
+      recoilZ0 = trk.getZ0();
+      auto QoP = trk.getQoP();
+      recoilP = 1000. / std::abs(QoP);
+      auto trk_mom = trk.getMomentum();
+      recoilPt = 1000 * std::sqrt(trk_mom[1] * trk_mom[1] + trk_mom[2] * trk_mom[2]);
+    }
+  }
+
+  // Per-event values by Feature, shared by the sketches and later consumers
+  double features[kNFeatures];
+  features[fRecoilX] = vetoNew.getRecoilX();
+  features[fSummedDet] = vetoNew.getSummedDet();
+  features[fSummedTightIso] = vetoNew.getSummedTightIso();
+  features[fEcalBackEnergy] = vetoNew.getEcalBackEnergy();
+  features[fNReadoutHits] = vetoNew.getNReadoutHits();
+  features[fShowerRMS] = vetoNew.getShowerRMS();
+  features[fXStd] = vetoNew.getXStd();
+  features[fYStd] = vetoNew.getYStd();
+  features[fMaxCellDep] = vetoNew.getMaxCellDep();
+  features[fStdLayerHit] = vetoNew.getStdLayerHit();
+  features[fNStraightTracks] = vetoNew.getNStraightTracks();
+  features[fNLinRegTracks] = vetoNew.getNLinRegTracks();
+  features[fAvgLayerHit] = vetoNew.getAvgLayerHit();
+  features[fDeepestLayerHit] = vetoNew.getDeepestLayerHit();
+  features[fFirstNearPhLayer] = vetoNew.getFirstNearPhLayer();
+  features[fEPAng] = vetoNew.getEPAng();
+  features[fEPSep] = vetoNew.getEPSep();
+  features[fBDTDisc] = vetoNew.getDisc();
+  features[fHcalMaxPE] = hcalMaxPE;
+  features[fHcalTotalPE] = hcalTotalPe;
+  features[fHcalTotalPEAbove8PE] = hcalTotalPeAbove8PE;
+  features[fHcalMaxTiming] = hcalMaxTiming;
+  features[fHcalMaxSector] = hcalMaxSector;
+  features[fTruthPT] = pT;
+  features[fTruthPZ] = pZ;
+  features[fTruthP] = totMom;
+  features[fTruthXAtTarget] = XAtTarget;
+  features[fTruthPTAtTarget] = pTAtTarget;
+  features[fTruthPZAtTarget] = pZAtTarget;
+  features[fTruthPAtTarget] = totMomAtTarget;
+  features[fTruthThetaAtTarget] = thetaEleAtTarget;
+  features[fTruthPhiAtTarget] = phiEleAtTarget;
+  features[fTaggerP] = taggerP;
+  features[fRecoilN] = recoilN;
+  features[fRecoilP] = recoilP;
+  features[fRecoilPt] = recoilPt;
+  features[fRecoilD0] = recoilD0;
+  features[fRecoilZ0] = recoilZ0;
+  features[fBDTDiscLog] = -log(1-vetoNew.getDisc());
+  features[fTrigger] = trigResult.passed();
+  features[fFiducial] = vetoNew.getFiducial();
+  features[fHcalVeto] = hcalVeto.passesVeto();
+  features[fAcceptance] = acceptance;
+  features[fAcceptanceFlag] = fiducial_analysis_flag;
+  if (patternVariable_ != kNFeatures) patternValue_ = features[patternVariable_];
+
+  if (featureStream_) {
+    double row[kNFeatures + 1];
+    std::copy(std::begin(features), std::end(features), row);
+    row[kNFeatures] = weight_;
+    featureStream_->push(row);
+    nStreamed_++;
+  }
+
+  if (!cut_record_file_.empty()) {
+    const auto &header{event.getEventHeader()};
+    cutRecords_.push_back(header.getRun());
+    cutRecords_.push_back(header.getEventNumber());
+    cutRecords_.resize(cutRecords_.size() + variants_.size(), 0);
+  }
+
+  if (batch_size_ > 0) {
+    for (int f = 0; f < kNFeatures; f++) block_[f][blockSize_] = features[f];
+    blockWeights_[blockSize_] = weight_;
+    if (++blockSize_ == batch_size_) processBlock();
+    return;
+  }
+
+  // Everything below depends on the variant, all of the above is shared
+  for (std::size_t v = 0; v < variants_.size(); v++) {
+    variant_ = &variants_[v];
+    if (!cut_record_file_.empty()) cutMask_ = &cutRecords_[cutRecords_.size() - variants_.size() + v];
+    (this->*variantKernels_[v])(vetoNew, hcalVeto, trigResult, features);
+  }
+}
+
+template <bool kSignal, bool kFiducial, bool kIgnoreFiducial, bool kIgnoreTagger>
+void CutBasedDM::analyzeVariant(const ldmx::EcalVetoResult &vetoNew, const ldmx::HcalVetoResult &hcalVeto,
+                                const ldmx::TriggerResult &trigResult, const double *features) {
+  // Per-event values as computed in analyzeEvent()
+  bool acceptance = features[fAcceptance];
+  int fiducial_analysis_flag = features[fAcceptanceFlag];
+  float pT = features[fTruthPT];
+  float pZ = features[fTruthPZ];
+  float totMom = features[fTruthP];
+  float XAtTarget = features[fTruthXAtTarget];
+  float pTAtTarget = features[fTruthPTAtTarget];
+  float pZAtTarget = features[fTruthPZAtTarget];
+  float totMomAtTarget = features[fTruthPAtTarget];
+  float thetaEleAtTarget = features[fTruthThetaAtTarget];
+  float phiEleAtTarget = features[fTruthPhiAtTarget];
+  float hcalMaxPE = features[fHcalMaxPE];
+  float hcalMaxTiming = features[fHcalMaxTiming];
+  int hcalMaxSector = features[fHcalMaxSector];
+  float hcalTotalPe = features[fHcalTotalPE];
+  float hcalTotalPeAbove8PE = features[fHcalTotalPEAbove8PE];
+  float taggerP = features[fTaggerP];
+  std::size_t recoilN = features[fRecoilN];
+  float recoilP = features[fRecoilP];
+  float recoilPt = features[fRecoilPt];
+  float recoilD0 = features[fRecoilD0];
+  float recoilZ0 = features[fRecoilZ0];
+
+
   // Trigger eff curves
-  histograms_.fill("TrigEffVsMissingE", trigResult.passed() , 8000.-vetoNew.getSummedDet() );
-  histograms_.fill("TrigEffVsRecoilPTAtTarget", trigResult.passed() , pTAtTarget );
+  fill(hTrigEffVsMissingE, trigResult.passed() , 8000.-vetoNew.getSummedDet() );
+  fill(hTrigEffVsRecoilPTAtTarget, trigResult.passed() , pTAtTarget );
 
 
   // std::cout << "Fiducial = " << vetoNew.getFiducial() << std::endl;
 
+  // Every cut once, the cut flows take theirs in the order of cutFlowSpecs
+  bool cutPassed[kNCuts];
+  for (int cut = 0; cut < kNCuts; cut++) {
+    cutPassed[cut] = passesCut(CutId(cut), features[cutSpecs[cut].feature], kFiducial, kIgnoreFiducial, kIgnoreTagger);
+  }
+
   // CutFlow here
-  bool passedCutsArrayCnC[13];
-  //std::cout << " CnC cutflow = " << std::endl;
-  std::fill(std::begin(passedCutsArrayCnC), std::end(passedCutsArrayCnC),false);
-  passedCutsArrayCnC[0]  = (acceptance) ? true : false;
-  passedCutsArrayCnC[1]  = (ignore_fiducial_analysis_ || (fiducial_analysis_ && vetoNew.getFiducial()) || (!fiducial_analysis_ && !vetoNew.getFiducial())) ? true : false;
-  passedCutsArrayCnC[2]  = (trigResult.passed()) ? true : false;
-  passedCutsArrayCnC[3]  = (vetoNew.getSummedDet() < 3500) ? true : false;
-  passedCutsArrayCnC[4]  = (vetoNew.getSummedTightIso() < 800) ? true : false;
-  passedCutsArrayCnC[5]  = (vetoNew.getEcalBackEnergy() < 250) ? true : false;
-  passedCutsArrayCnC[6]  = (vetoNew.getNReadoutHits() < 70) ? true : false;
-  passedCutsArrayCnC[7]  = (vetoNew.getShowerRMS() < 110) ? true : false;
-  passedCutsArrayCnC[8]  = (vetoNew.getYStd() < 70) ? true : false;
-  passedCutsArrayCnC[9]  = (vetoNew.getMaxCellDep() < 300) ? true : false;
-  passedCutsArrayCnC[10]  = (vetoNew.getStdLayerHit() < 5) ? true : false;
-  passedCutsArrayCnC[11]  = (vetoNew.getNStraightTracks() < 3) ? true : false;
-  passedCutsArrayCnC[12]  = (hcalVeto.passesVeto()) ? true : false;
+  bool passedCutsArrayCnC[kNCuts];
+  const size_t nCnC{flowOutcomes(kFlowCnC, cutPassed, passedCutsArrayCnC)};
 
   // Fill histograms
 
-  bool has_min_energy       = fiducial_analysis_flag & (1 << 0);
-  bool has_min_tracker_hits = fiducial_analysis_flag & (1 << 1);
-  bool has_ecal_hit         = fiducial_analysis_flag & (1 << 2);
-  bool has_hcal_hit         = fiducial_analysis_flag & (1 << 3);
-  if (fiducial_analysis_flag > 0) {
-    histograms_.fill("Acceptance", 0. , vetoNew.getRecoilX() );
-    if (has_min_energy) histograms_.fill("Acceptance", 1. , vetoNew.getRecoilX() );
-    if (has_min_tracker_hits) histograms_.fill("Acceptance", 2. , vetoNew.getRecoilX() );
-    if (has_ecal_hit) histograms_.fill("Acceptance", 3. , vetoNew.getRecoilX() );
-    if (has_hcal_hit) histograms_.fill("Acceptance", 4. , vetoNew.getRecoilX() );
-    if (acceptance) histograms_.fill("Acceptance", 5. , vetoNew.getRecoilX() );
+  // The acceptance flags only exist for signal
+  if constexpr (kSignal) {
+    bool has_min_energy       = fiducial_analysis_flag & (1 << 0);
+    bool has_min_tracker_hits = fiducial_analysis_flag & (1 << 1);
+    bool has_ecal_hit         = fiducial_analysis_flag & (1 << 2);
+    bool has_hcal_hit         = fiducial_analysis_flag & (1 << 3);
+    if (fiducial_analysis_flag > 0) {
+      fill(hAcceptance, 0. , vetoNew.getRecoilX() );
+      if (has_min_energy) fill(hAcceptance, 1. , vetoNew.getRecoilX() );
+      if (has_min_tracker_hits) fill(hAcceptance, 2. , vetoNew.getRecoilX() );
+      if (has_ecal_hit) fill(hAcceptance, 3. , vetoNew.getRecoilX() );
+      if (has_hcal_hit) fill(hAcceptance, 4. , vetoNew.getRecoilX() );
+      if (acceptance) fill(hAcceptance, 5. , vetoNew.getRecoilX() );
+    }
   }
-  
 
-  for (size_t i=0;i<sizeof(passedCutsArrayCnC);i++) {
+
+  countPassed(kFlowCnC, passedCutsArrayCnC, nCnC);
+  for (size_t i=0;i<nCnC;i++) {
     bool allCutsPassedSoFar = true;
     for (size_t j=0;j<=i;j++) {
       if (!passedCutsArrayCnC[j]) {
@@ -656,72 +2143,60 @@ void CutBasedDM::analyze(const framework::Event& event) {
       // //std::cout << "hcalMaxPE = " <<  hcalMaxPE << " hcal total" << hcalTotalPe <<  " maxTime = " << hcalMaxTiming << " where = " << hcalMaxSector
       // << std::endl;
 
-      histograms_.fill("RecoilX", i, vetoNew.getRecoilX() );
-      histograms_.fill("AvgLayerHit", i, vetoNew.getAvgLayerHit() );
-      histograms_.fill("DeepestLayerHit", i, vetoNew.getDeepestLayerHit() );
-      histograms_.fill("EcalBackEnergy", i, vetoNew.getEcalBackEnergy() );
-      histograms_.fill("EpAng", i, vetoNew.getEPAng() );
-      histograms_.fill("EpSep", i, vetoNew.getEPSep() );
-      histograms_.fill("FirstNearPhLayer", i, vetoNew.getFirstNearPhLayer() );
-      histograms_.fill("MaxCellDep", i, vetoNew.getMaxCellDep() );
-      histograms_.fill("NReadoutHits", i, vetoNew.getNReadoutHits() );
-      histograms_.fill("StdLayerHit", i, vetoNew.getStdLayerHit() );
-      histograms_.fill("Straight", i, vetoNew.getNStraightTracks() );
-      histograms_.fill("LinRegNew", i, vetoNew.getNLinRegTracks() );
-      histograms_.fill("SummedDet", i, vetoNew.getSummedDet() );
-      histograms_.fill("SummedTightIso", i, vetoNew.getSummedTightIso() );
-      histograms_.fill("ShowerRMS", i, vetoNew.getShowerRMS() );
-      histograms_.fill("XStd", i, vetoNew.getXStd() );
-      histograms_.fill("YStd", i, vetoNew.getYStd() );
-      histograms_.fill("BDTDiscr", i, vetoNew.getDisc() );
-      histograms_.fill("BDTDiscrLog", i, -log(1-vetoNew.getDisc()) );
-      histograms_.fill("StdCutFlow_RecoilX", i, vetoNew.getRecoilX() );
-      histograms_.fill("RecoilPT", i, pT );
-      histograms_.fill("RecoilPZ", i, pZ );
-      histograms_.fill("RecoilP", i, totMom );
-      histograms_.fill("RecoilXAtTarget", i,XAtTarget );
-      histograms_.fill("RecoilPTAtTarget", i,pTAtTarget );
-      histograms_.fill("RecoilPZAtTarget", i, pZAtTarget );
-      histograms_.fill("RecoilPAtTarget", i, totMomAtTarget );
-      histograms_.fill("RecoilTheta", i, thetaEleAtTarget );
-      histograms_.fill("RecoilPhi", i, phiEleAtTarget );
-      histograms_.fill("Hcal_MaxPE", i, hcalMaxPE );
-      histograms_.fill("Hcal_MaxPE_Extended", i, hcalMaxPE );
-      histograms_.fill("Hcal_TotalPE", i, hcalTotalPe );
-      histograms_.fill("Hcal_TotalPE_AboveMax8PE", i, hcalTotalPeAbove8PE );
-      histograms_.fill("Hcal_MaxTiming", i, hcalMaxTiming );
-      histograms_.fill("Hcal_MaxSector", i, hcalMaxSector );
+      fill(hRecoilX, i, vetoNew.getRecoilX() );
+      fill(hAvgLayerHit, i, vetoNew.getAvgLayerHit() );
+      fill(hDeepestLayerHit, i, vetoNew.getDeepestLayerHit() );
+      fill(hEcalBackEnergy, i, vetoNew.getEcalBackEnergy() );
+      fill(hEpAng, i, vetoNew.getEPAng() );
+      fill(hEpSep, i, vetoNew.getEPSep() );
+      fill(hFirstNearPhLayer, i, vetoNew.getFirstNearPhLayer() );
+      fill(hMaxCellDep, i, vetoNew.getMaxCellDep() );
+      fill(hNReadoutHits, i, vetoNew.getNReadoutHits() );
+      fill(hStdLayerHit, i, vetoNew.getStdLayerHit() );
+      fill(hStraight, i, vetoNew.getNStraightTracks() );
+      fill(hLinRegNew, i, vetoNew.getNLinRegTracks() );
+      fill(hSummedDet, i, vetoNew.getSummedDet() );
+      fill(hSummedTightIso, i, vetoNew.getSummedTightIso() );
+      fill(hShowerRMS, i, vetoNew.getShowerRMS() );
+      fill(hXStd, i, vetoNew.getXStd() );
+      fill(hYStd, i, vetoNew.getYStd() );
+      fill(hBDTDiscr, i, vetoNew.getDisc() );
+      fill(hBDTDiscrLog, i, -log(1-vetoNew.getDisc()) );
+      fill(hStdCutFlow_RecoilX, i, vetoNew.getRecoilX() );
+      fill(hRecoilPT, i, pT );
+      fill(hRecoilPZ, i, pZ );
+      fill(hRecoilP, i, totMom );
+      fill(hRecoilXAtTarget, i,XAtTarget );
+      fill(hRecoilPTAtTarget, i,pTAtTarget );
+      fill(hRecoilPZAtTarget, i, pZAtTarget );
+      fill(hRecoilPAtTarget, i, totMomAtTarget );
+      fill(hRecoilTheta, i, thetaEleAtTarget );
+      fill(hRecoilPhi, i, phiEleAtTarget );
+      fill(hHcal_MaxPE, i, hcalMaxPE );
+      fill(hHcal_MaxPE_Extended, i, hcalMaxPE );
+      fill(hHcal_TotalPE, i, hcalTotalPe );
+      fill(hHcal_TotalPE_AboveMax8PE, i, hcalTotalPeAbove8PE );
+      fill(hHcal_MaxTiming, i, hcalMaxTiming );
+      fill(hHcal_MaxSector, i, hcalMaxSector );
+      fillSketches(i, features);
 
       if (i==1) {
-        histograms_.fill("BDTDiscrVsHcalPE_PreS", hcalMaxPE , vetoNew.getDisc() );
-        histograms_.fill("BDTDiscrLogVsHcalPE_PreS", hcalMaxPE , -log(1-vetoNew.getDisc()) );
+        fill(hBDTDiscrVsHcalPE_PreS, hcalMaxPE , vetoNew.getDisc() );
+        fill(hBDTDiscrLogVsHcalPE_PreS, hcalMaxPE , -log(1-vetoNew.getDisc()) );
       } 
       if (i==10) {
-        histograms_.fill("BDTDiscrVsHcalPE_PostS", hcalMaxPE , vetoNew.getDisc() );
-        histograms_.fill("BDTDiscrLogVsHcalPE_PostS", hcalMaxPE , -log(1-vetoNew.getDisc()) );
+        fill(hBDTDiscrVsHcalPE_PostS, hcalMaxPE , vetoNew.getDisc() );
+        fill(hBDTDiscrLogVsHcalPE_PostS, hcalMaxPE , -log(1-vetoNew.getDisc()) );
       }
     }
   }
 
   // Alternative cutFlow here
-  bool passedCutsArrayAlt[13];
-  //std::cout << " Alternative cutFlow here " << std::endl;
-  std::fill(std::begin(passedCutsArrayAlt), std::end(passedCutsArrayAlt),false);
-  passedCutsArrayAlt[0]  = (acceptance) ? true : false;
-  passedCutsArrayAlt[1]  = (ignore_fiducial_analysis_ || (fiducial_analysis_ && vetoNew.getFiducial()) || (!fiducial_analysis_ && !vetoNew.getFiducial())) ? true : false;
-  passedCutsArrayAlt[2]  = (trigResult.passed()) ? true : false;
-  passedCutsArrayAlt[3]  = (vetoNew.getSummedDet() < 3500) ? true : false;
-  passedCutsArrayAlt[4]  = (vetoNew.getSummedTightIso() < 800) ? true : false;
-  passedCutsArrayAlt[5]  = (vetoNew.getEcalBackEnergy() < 250) ? true : false;
-  passedCutsArrayAlt[6]  = (vetoNew.getNReadoutHits() < 70) ? true : false;
-  passedCutsArrayAlt[7]  = (vetoNew.getShowerRMS() < 110) ? true : false;
-  passedCutsArrayAlt[8]  = (vetoNew.getYStd() < 70) ? true : false;
-  passedCutsArrayAlt[9]  = (vetoNew.getMaxCellDep() < 300) ? true : false;
-  passedCutsArrayAlt[10]  = (vetoNew.getStdLayerHit() < 5) ? true : false;
-  passedCutsArrayAlt[11]  = (vetoNew.getNStraightTracks() < 3) ? true : false;
-  passedCutsArrayAlt[12]  = (hcalVeto.passesVeto()) ? true : false;
-
-  for (size_t i=0;i<sizeof(passedCutsArrayAlt);i++) {
+  bool passedCutsArrayAlt[kNCuts];
+  const size_t nAlt{flowOutcomes(kFlowAlt, cutPassed, passedCutsArrayAlt)};
+
+  countPassed(kFlowAlt, passedCutsArrayAlt, nAlt);
+  for (size_t i=0;i<nAlt;i++) {
     bool allCutsPassedSoFar = true;
     for (size_t j=0;j<=i;j++) {
       if (!passedCutsArrayAlt[j]) {
@@ -745,29 +2220,16 @@ void CutBasedDM::analyze(const framework::Event& event) {
       //   << " getNStraightTracks = " << vetoNew.getNStraightTracks()
       //   << " hcalVeto = " << hcalVeto.passesVeto() << std::endl;
       // std::cout << "hcalMaxPE = " <<  hcalMaxPE << " hcal total" << hcalTotalPe <<  " maxTime = " << hcalMaxTiming << " where = " << hcalMaxSector << std::endl;
-      histograms_.fill("AltCutFlow_RecoilX", i, vetoNew.getRecoilX() );
+      fill(hAltCutFlow_RecoilX, i, vetoNew.getRecoilX() );
     }
   }
 
   // BDT based cutFlow here
-  bool passedCutsArrayBDT[8];
-  //std::cout << " BDT cutFlow here " << std::endl;
-  std::fill(std::begin(passedCutsArrayBDT), std::end(passedCutsArrayBDT),false);
-  passedCutsArrayBDT[0]  = (acceptance) ? true : false;
-  passedCutsArrayBDT[1]  = (ignore_fiducial_analysis_ || (fiducial_analysis_ && vetoNew.getFiducial()) || (!fiducial_analysis_ && !vetoNew.getFiducial())) ? true : false;
-  passedCutsArrayBDT[2]  = (trigResult.passed()) ? true : false;
-  passedCutsArrayBDT[3]  = (vetoNew.getDisc() > 0.99741) ? true : false;
-  passedCutsArrayBDT[4]  = (vetoNew.getNStraightTracks() < 3) ? true : false;
-  passedCutsArrayBDT[5]  = (hcalVeto.passesVeto()) ? true : false;
-  passedCutsArrayBDT[6]  = (vetoNew.getNStraightTracks() == 0) ? true : false;
-  if (fiducial_analysis_) {
-    passedCutsArrayBDT[7]  = (vetoNew.getEPAng() > 3)  ? true : false;
-  } else {
-    passedCutsArrayBDT[7]  = true;
-  }
-
+  bool passedCutsArrayBDT[kNCuts];
+  const size_t nBDT{flowOutcomes(kFlowBDT, cutPassed, passedCutsArrayBDT)};
 
-  for (size_t i=0;i<sizeof(passedCutsArrayBDT);i++) {
+  countPassed(kFlowBDT, passedCutsArrayBDT, nBDT);
+  for (size_t i=0;i<nBDT;i++) {
     bool allCutsPassedSoFar = true;
     for (size_t j=0;j<=i;j++) {
       if (!passedCutsArrayBDT[j]) {
@@ -777,7 +2239,7 @@ void CutBasedDM::analyze(const framework::Event& event) {
     }
     if (allCutsPassedSoFar) {
       // std::cout << " vetoNew.getEPAng() = " << vetoNew.getEPAng() << "  i = " << i << std::endl;
-      histograms_.fill("BDTCutFlow_RecoilX", i, vetoNew.getRecoilX() );
+      fill(hBDTCutFlow_RecoilX, i, vetoNew.getRecoilX() );
     }
   }
 
@@ -802,7 +2264,7 @@ void CutBasedDM::analyze(const framework::Event& event) {
   //     }
   //   }
   //   if (allCutsPassedSoFar) {
-  //     histograms_.fill("LinRegCutFlow_RecoilX", i, vetoNew.getRecoilX() );
+  //     fill(hLinRegCutFlow_RecoilX, i, vetoNew.getRecoilX() );
   //   }
   // }
 
@@ -827,67 +2289,17 @@ void CutBasedDM::analyze(const framework::Event& event) {
   //   }
   //   if (allCutsPassedSoFar) {
 
-  //     histograms_.fill("LinRegCutFlowHcal_RecoilX", i, vetoNew.getRecoilX() );
+  //     fill(hLinRegCutFlowHcal_RecoilX, i, vetoNew.getRecoilX() );
   //   }
   // }
-  // --------------------------------------------------------------------------
-  // Calculate tracking variables if tracking is available
-  //std::cout << " Tracking variables = " << std::endl;
-  float taggerP{0.0}; // Make sure this is in MeV!!
-  // Start with tagger tracks
-  auto taggerN = taggerTrackCollection.size();
-  // std::cout << " taggerN = " << taggerN << std::endl;
-  if (taggerN == 1) {
-    for (const auto trk : taggerTrackCollection) {
-      auto QoP = trk.getQoP();
-      taggerP = 1000. / std::abs(QoP);
-    }
-  }
-
-  // Recoil tracks now
-  float recoilP{0.0}; // Make sure this is in MeV!!
-  float recoilPt{0.0}; // Make sure this is in MeV!!
-  float recoilD0{-9999.};
-  float recoilZ0{-9999.};
-  auto recoilN = recoilTrackCollection.size();
-  //std::cout << " recoilN = " << recoilN << std::endl;
-  if (recoilN == 1) {
-    for (const auto trk : recoilTrackCollection) {
-      recoilD0 = trk.getD0();
-      recoilZ0 = trk.getZ0();
-      auto QoP = trk.getQoP();
-      recoilP = 1000. / std::abs(QoP);
-      auto trk_mom = trk.getMomentum();
-      recoilPt = 1000 * std::sqrt(trk_mom[1] * trk_mom[1] + trk_mom[2] * trk_mom[2]);
-    }
-  }
-
   // --------------------------------------------------------------------------
   // CnC based cutFlow with tracking
   // CutFlow here
-  bool passedCutsArrayCnCWithTracking[18];
-  //std::cout << " CnC cutflow = " << std::endl;
-  std::fill(std::begin(passedCutsArrayCnCWithTracking), std::end(passedCutsArrayCnCWithTracking),false);
-  passedCutsArrayCnCWithTracking[0]  = (acceptance) ? true : false;
-  passedCutsArrayCnCWithTracking[1]  = (ignore_fiducial_analysis_ || (fiducial_analysis_ && vetoNew.getFiducial()) || (!fiducial_analysis_ && !vetoNew.getFiducial())) ? true : false;
-  passedCutsArrayCnCWithTracking[2]  = (trigResult.passed()) ? true : false;
-  passedCutsArrayCnCWithTracking[3]  = (ignore_tagger_analysis_ || (taggerP > 5600)) ? true : false;
-  passedCutsArrayCnCWithTracking[4]  = (recoilN == 1) ? true : false;
-  passedCutsArrayCnCWithTracking[5]  = (std::abs(recoilD0) < 10.) ? true : false;
-  passedCutsArrayCnCWithTracking[6]  = (std::abs(recoilZ0) < 40.) ? true : false; 
-  passedCutsArrayCnCWithTracking[7]  = (vetoNew.getSummedDet() < 3500) ? true : false;
-  passedCutsArrayCnCWithTracking[8]  = (vetoNew.getSummedTightIso() < 800) ? true : false;
-  passedCutsArrayCnCWithTracking[9]  = (vetoNew.getEcalBackEnergy() < 250) ? true : false;
-  passedCutsArrayCnCWithTracking[10]  = (vetoNew.getNReadoutHits() < 70) ? true : false;
-  passedCutsArrayCnCWithTracking[11]  = (vetoNew.getShowerRMS() < 110) ? true : false;
-  passedCutsArrayCnCWithTracking[12]  = (vetoNew.getYStd() < 70) ? true : false;
-  passedCutsArrayCnCWithTracking[13]  = (vetoNew.getMaxCellDep() < 300) ? true : false;
-  passedCutsArrayCnCWithTracking[14]  = (vetoNew.getStdLayerHit() < 5) ? true : false;
-  passedCutsArrayCnCWithTracking[15]  = (vetoNew.getNStraightTracks() < 3) ? true : false;
-  passedCutsArrayCnCWithTracking[16]  = (hcalVeto.passesVeto()) ? true : false;
-  passedCutsArrayCnCWithTracking[17]  = (vetoNew.getNStraightTracks() == 0) ? true : false;
-
-  for (size_t i=0;i<sizeof(passedCutsArrayCnCWithTracking);i++) {
+  bool passedCutsArrayCnCWithTracking[kNCuts];
+  const size_t nCnCWithTracking{flowOutcomes(kFlowCnCWithTracking, cutPassed, passedCutsArrayCnCWithTracking)};
+
+  countPassed(kFlowCnCWithTracking, passedCutsArrayCnCWithTracking, nCnCWithTracking);
+  for (size_t i=0;i<nCnCWithTracking;i++) {
     bool allCutsPassedSoFar = true;
     for (size_t j=0;j<=i;j++) {
       if (!passedCutsArrayCnCWithTracking[j]) {
@@ -896,31 +2308,16 @@ void CutBasedDM::analyze(const framework::Event& event) {
       }
     }
     if (allCutsPassedSoFar) {
-      histograms_.fill("StdCutFlowWithTracking_RecoilX", i, vetoNew.getRecoilX() );
+      fill(hStdCutFlowWithTracking_RecoilX, i, vetoNew.getRecoilX() );
     }
   }
 
   // BDT based cutFlow with tracking
-  bool passedCutsArrayTracking[12];
-  std::fill(std::begin(passedCutsArrayTracking), std::end(passedCutsArrayTracking),false);
-  passedCutsArrayTracking[0]  = (acceptance) ? true : false;
-  passedCutsArrayTracking[1]  = (ignore_fiducial_analysis_ || (fiducial_analysis_ && vetoNew.getFiducial()) || (!fiducial_analysis_ && !vetoNew.getFiducial())) ? true : false;
-  passedCutsArrayTracking[2]  = (trigResult.passed()) ? true : false;
-  passedCutsArrayTracking[3]  = (ignore_tagger_analysis_ || (taggerP > 5600)) ? true : false;
-  passedCutsArrayTracking[4]  = (recoilN == 1) ? true : false;
-  passedCutsArrayTracking[5]  = (std::abs(recoilD0) < 10.) ? true : false;
-  passedCutsArrayTracking[6]  = (std::abs(recoilZ0) < 40.) ? true : false;
-  passedCutsArrayTracking[7]  = (vetoNew.getDisc() > 0.99741) ? true : false;
-  passedCutsArrayTracking[8]  = (vetoNew.getNStraightTracks() < 3) ? true : false;
-  passedCutsArrayTracking[9]  = (hcalVeto.passesVeto()) ? true : false;
-  passedCutsArrayTracking[10]  = (vetoNew.getNStraightTracks() == 0) ? true : false;
-  if (fiducial_analysis_) {
-    passedCutsArrayTracking[11]  = (vetoNew.getEPAng() > 3)  ? true : false;
-  } else {
-    passedCutsArrayTracking[11]  = true;
-  }
+  bool passedCutsArrayTracking[kNCuts];
+  const size_t nTracking{flowOutcomes(kFlowTracking, cutPassed, passedCutsArrayTracking)};
 
-  for (size_t i=0;i<sizeof(passedCutsArrayTracking);i++) {
+  countPassed(kFlowTracking, passedCutsArrayTracking, nTracking);
+  for (size_t i=0;i<nTracking;i++) {
     bool allCutsPassedSoFar = true;
     for (size_t j=0;j<=i;j++) {
       if (!passedCutsArrayTracking[j]) {
@@ -929,40 +2326,25 @@ void CutBasedDM::analyze(const framework::Event& event) {
       }
     }
     if (allCutsPassedSoFar) {
-      histograms_.fill("TrackingCutFlow_RecoilX", i, vetoNew.getRecoilX() );
-      if (i == (sizeof(passedCutsArrayTracking)-1) && !signal_) {
-        std::cout << " This bkg event survived all the cuts!!!" << std::endl;
+      fill(hTrackingCutFlow_RecoilX, i, vetoNew.getRecoilX() );
+      if (i == (nTracking-1) && !kSignal) {
+        ldmx_log(debug) << "This bkg event survived all the cuts";
       }
-      histograms_.fill("Tracking_TaggerP", i, taggerP);
-      histograms_.fill("Tracking_RecoilN", i, recoilN);
-      histograms_.fill("Tracking_RecoilP", i, recoilP);
-      histograms_.fill("Tracking_RecoilPt", i, recoilPt);
-      histograms_.fill("Tracking_RecoilD0", i, recoilD0);
-      histograms_.fill("Tracking_RecoilZ0", i, recoilZ0);
+      fill(hTracking_TaggerP, i, taggerP);
+      fill(hTracking_RecoilN, i, recoilN);
+      fill(hTracking_RecoilP, i, recoilP);
+      fill(hTracking_RecoilPt, i, recoilPt);
+      fill(hTracking_RecoilD0, i, recoilD0);
+      fill(hTracking_RecoilZ0, i, recoilZ0);
     }
   }
 
   // BDT based cutFlow with tracking starting with Hcal and Ecal veto
-  bool passedCutsArrayTrackingHcal[11];
-  std::fill(std::begin(passedCutsArrayTrackingHcal), std::end(passedCutsArrayTrackingHcal),false);
-  passedCutsArrayTrackingHcal[0]  = (acceptance) ? true : false;
-  passedCutsArrayTrackingHcal[1]  = (ignore_fiducial_analysis_ || (fiducial_analysis_ && vetoNew.getFiducial()) || (!fiducial_analysis_ && !vetoNew.getFiducial())) ? true : false;
-  passedCutsArrayTrackingHcal[2]  = (trigResult.passed()) ? true : false;
-  passedCutsArrayTrackingHcal[3]  = (hcalVeto.passesVeto()) ? true : false;
-  passedCutsArrayTrackingHcal[4]  = (vetoNew.getDisc() > 0.99741) ? true : false;
-  passedCutsArrayTrackingHcal[5]  = (vetoNew.getNStraightTracks() == 0) ? true : false;
-  if (fiducial_analysis_) {
-    passedCutsArrayTrackingHcal[6]  = ((vetoNew.getEPAng() > 3))  ? true : false;
-  } else {
-    passedCutsArrayTrackingHcal[6]  = true;
-  }
-  passedCutsArrayTrackingHcal[7]  = (taggerP > 5600) ? true : false;
-  passedCutsArrayTrackingHcal[8]  = (recoilN == 1) ? true : false;
-  passedCutsArrayTrackingHcal[9]  = (std::abs(recoilD0) < 10) ? true : false;
-  passedCutsArrayTrackingHcal[10]  = (std::abs(recoilZ0) < 40) ? true : false;
-
+  bool passedCutsArrayTrackingHcal[kNCuts];
+  const size_t nTrackingHcal{flowOutcomes(kFlowTrackingHcal, cutPassed, passedCutsArrayTrackingHcal)};
 
-  for (size_t i=0;i<sizeof(passedCutsArrayTrackingHcal);i++) {
+  countPassed(kFlowTrackingHcal, passedCutsArrayTrackingHcal, nTrackingHcal);
+  for (size_t i=0;i<nTrackingHcal;i++) {
     bool allCutsPassedSoFar = true;
     for (size_t j=0;j<=i;j++) {
       if (!passedCutsArrayTrackingHcal[j]) {
@@ -971,33 +2353,21 @@ void CutBasedDM::analyze(const framework::Event& event) {
       }
     }
     if (allCutsPassedSoFar) {
-      histograms_.fill("TrackingCutFlowHcal_RecoilX", i, vetoNew.getRecoilX() );
-      histograms_.fill("TrackingHcal_TaggerP", i, taggerP);
-      histograms_.fill("TrackingHcal_RecoilN", i, recoilN);
-      histograms_.fill("TrackingHcal_RecoilD0", i, recoilD0);
-      histograms_.fill("TrackingHcal_RecoilZ0", i, recoilZ0);
+      fill(hTrackingCutFlowHcal_RecoilX, i, vetoNew.getRecoilX() );
+      fill(hTrackingHcal_TaggerP, i, taggerP);
+      fill(hTrackingHcal_RecoilN, i, recoilN);
+      fill(hTrackingHcal_RecoilD0, i, recoilD0);
+      fill(hTrackingHcal_RecoilZ0, i, recoilZ0);
     }
   }
 
   // --------------------------------------------------------------------------
   // Reverse cutflow, i.e. start with the last cut from the original cutflow
-  bool passedCutsArrayReverse[13];
-  std::fill(std::begin(passedCutsArrayReverse), std::end(passedCutsArrayReverse),false);
-  passedCutsArrayReverse[0]  = (acceptance) ? true : false;
-  passedCutsArrayReverse[1]  = (ignore_fiducial_analysis_ || (fiducial_analysis_ && vetoNew.getFiducial()) || (!fiducial_analysis_ && !vetoNew.getFiducial())) ? true : false;
-  passedCutsArrayReverse[2]  = (trigResult.passed()) ? true : false;
-  passedCutsArrayReverse[3]  = (hcalVeto.passesVeto()) ? true : false;
-  passedCutsArrayReverse[4]  = (vetoNew.getNStraightTracks() < 3) ? true : false;
-  passedCutsArrayReverse[5]  = (vetoNew.getStdLayerHit() < 5) ? true : false;
-  passedCutsArrayReverse[6]  = (vetoNew.getMaxCellDep() < 300) ? true : false;
-  passedCutsArrayReverse[7]  = (vetoNew.getYStd() < 70) ? true : false;
-  passedCutsArrayReverse[8]  = (vetoNew.getShowerRMS() < 110) ? true : false;
-  passedCutsArrayReverse[9]  = (vetoNew.getNReadoutHits() < 70) ? true : false;
-  passedCutsArrayReverse[10]  = (vetoNew.getEcalBackEnergy() < 250) ? true : false;
-  passedCutsArrayReverse[11]  = (vetoNew.getSummedTightIso() < 800) ? true : false;
-  passedCutsArrayReverse[12]  = (vetoNew.getSummedDet() < 3500) ? true : false;
-
-  for (size_t i=0;i<sizeof(passedCutsArrayReverse);i++) {
+  bool passedCutsArrayReverse[kNCuts];
+  const size_t nReverse{flowOutcomes(kFlowRev, cutPassed, passedCutsArrayReverse)};
+
+  countPassed(kFlowRev, passedCutsArrayReverse, nReverse);
+  for (size_t i=0;i<nReverse;i++) {
     bool allCutsPassedSoFar = true;
     for (size_t j=0;j<=i;j++) {
       if (!passedCutsArrayReverse[j]) {
@@ -1005,35 +2375,35 @@ void CutBasedDM::analyze(const framework::Event& event) {
       }
     }
     if (allCutsPassedSoFar) {
-      histograms_.fill("Rev_AvgLayerHit", i, vetoNew.getAvgLayerHit() );
-      histograms_.fill("Rev_DeepestLayerHit", i, vetoNew.getDeepestLayerHit() );
-      histograms_.fill("Rev_EcalBackEnergy", i, vetoNew.getEcalBackEnergy() );
-      histograms_.fill("Rev_EpAng", i, vetoNew.getEPAng() );
-      histograms_.fill("Rev_EpSep", i, vetoNew.getEPSep() );
-      histograms_.fill("Rev_FirstNearPhLayer", i, vetoNew.getFirstNearPhLayer() );
-      histograms_.fill("Rev_MaxCellDep", i, vetoNew.getMaxCellDep() );
-      histograms_.fill("Rev_NReadoutHits", i, vetoNew.getNReadoutHits() );
-      histograms_.fill("Rev_StdLayerHit", i, vetoNew.getStdLayerHit() );
-      histograms_.fill("Rev_Straight", i, vetoNew.getNStraightTracks() );
-      // histograms_.fill("Rev_LinRegNew", i, vetoNew.getNLinRegTracks() );
-      histograms_.fill("Rev_SummedDet", i, vetoNew.getSummedDet() );
-      histograms_.fill("Rev_SummedTightIso", i, vetoNew.getSummedTightIso() );
-      histograms_.fill("Rev_ShowerRMS", i, vetoNew.getShowerRMS() );
-      histograms_.fill("Rev_XStd", i, vetoNew.getXStd() );
-      histograms_.fill("Rev_YStd", i, vetoNew.getYStd() );
-      histograms_.fill("Rev_Hcal_MaxPE", i, hcalMaxPE );
-      histograms_.fill("Rev_Hcal_TotalPE", i, hcalTotalPe );
-      histograms_.fill("Rev_Hcal_MaxTiming", i, hcalMaxTiming );
-      histograms_.fill("Rev_Hcal_MaxSector", i, hcalMaxSector );
+      fill(hRev_AvgLayerHit, i, vetoNew.getAvgLayerHit() );
+      fill(hRev_DeepestLayerHit, i, vetoNew.getDeepestLayerHit() );
+      fill(hRev_EcalBackEnergy, i, vetoNew.getEcalBackEnergy() );
+      fill(hRev_EpAng, i, vetoNew.getEPAng() );
+      fill(hRev_EpSep, i, vetoNew.getEPSep() );
+      fill(hRev_FirstNearPhLayer, i, vetoNew.getFirstNearPhLayer() );
+      fill(hRev_MaxCellDep, i, vetoNew.getMaxCellDep() );
+      fill(hRev_NReadoutHits, i, vetoNew.getNReadoutHits() );
+      fill(hRev_StdLayerHit, i, vetoNew.getStdLayerHit() );
+      fill(hRev_Straight, i, vetoNew.getNStraightTracks() );
+      // fill(hRev_LinRegNew, i, vetoNew.getNLinRegTracks() );
+      fill(hRev_SummedDet, i, vetoNew.getSummedDet() );
+      fill(hRev_SummedTightIso, i, vetoNew.getSummedTightIso() );
+      fill(hRev_ShowerRMS, i, vetoNew.getShowerRMS() );
+      fill(hRev_XStd, i, vetoNew.getXStd() );
+      fill(hRev_YStd, i, vetoNew.getYStd() );
+      fill(hRev_Hcal_MaxPE, i, hcalMaxPE );
+      fill(hRev_Hcal_TotalPE, i, hcalTotalPe );
+      fill(hRev_Hcal_MaxTiming, i, hcalMaxTiming );
+      fill(hRev_Hcal_MaxSector, i, hcalMaxSector );
     }
   }
-  
+
     // // N-1 plots
     // // << "      >> Doing N1 plots";
     // // i=0 is trigger, i=1 is fiducial
-    //  for (size_t i=2;i<sizeof(passedCutsArrayCnC);i++) {
+    //  for (size_t i=2;i<nCnC;i++) {
     //    bool allOtherCutsPassed = true;
-    //    for (size_t j=2;j<sizeof(passedCutsArrayCnC);j++) {
+    //    for (size_t j=2;j<nCnC;j++) {
     //      if (i==j) continue;
     //      if (!passedCutsArrayCnC[j]) {
     //        allOtherCutsPassed = false;
@@ -1043,29 +2413,29 @@ void CutBasedDM::analyze(const framework::Event& event) {
     //    }
 
     //    if (allOtherCutsPassed && trigResult.passed() && ((fiducial_analysis_ && vetoNew.getFiducial()) || (!fiducial_analysis_ && !vetoNew.getFiducial()))) {
-    //     if (i==2) histograms_.fill("N1_SummedDet", i, vetoNew.getSummedDet() );
-    //     if (i==3) histograms_.fill("N1_SummedTightIso", i, vetoNew.getSummedTightIso() );
-    //     if (i==4) histograms_.fill("N1_EcalBackEnergy", i, vetoNew.getEcalBackEnergy() );
-    //     if (i==5) histograms_.fill("N1_NReadoutHits", i, vetoNew.getNReadoutHits() );
-    //     if (i==6) histograms_.fill("N1_ShowerRMS", i, vetoNew.getShowerRMS() );
-    //     if (i==7) histograms_.fill("N1_YStd", i, vetoNew.getYStd() );
-    //     if (i==8) histograms_.fill("N1_MaxCellDep", i, vetoNew.getMaxCellDep() );
-    //     if (i==9) histograms_.fill("N1_StdLayerHit", i, vetoNew.getStdLayerHit() );
-    //     if (i==10) histograms_.fill("N1_Straight", i, vetoNew.getNStraightTracks() );
+    //     if (i==2) fill(hN1_SummedDet, i, vetoNew.getSummedDet() );
+    //     if (i==3) fill(hN1_SummedTightIso, i, vetoNew.getSummedTightIso() );
+    //     if (i==4) fill(hN1_EcalBackEnergy, i, vetoNew.getEcalBackEnergy() );
+    //     if (i==5) fill(hN1_NReadoutHits, i, vetoNew.getNReadoutHits() );
+    //     if (i==6) fill(hN1_ShowerRMS, i, vetoNew.getShowerRMS() );
+    //     if (i==7) fill(hN1_YStd, i, vetoNew.getYStd() );
+    //     if (i==8) fill(hN1_MaxCellDep, i, vetoNew.getMaxCellDep() );
+    //     if (i==9) fill(hN1_StdLayerHit, i, vetoNew.getStdLayerHit() );
+    //     if (i==10) fill(hN1_Straight, i, vetoNew.getNStraightTracks() );
     //     if (i==11) {
-    //       histograms_.fill("N1_Hcal_MaxPE", i, hcalMaxPE );
-    //       histograms_.fill("N1_Hcal_TotalPE", i, hcalTotalPe );
-    //       histograms_.fill("N1_Hcal_MaxTiming", i, hcalMaxTiming );
-    //       histograms_.fill("N1_Hcal_MaxSector", i, hcalMaxSector );
+    //       fill(hN1_Hcal_MaxPE, i, hcalMaxPE );
+    //       fill(hN1_Hcal_TotalPE, i, hcalTotalPe );
+    //       fill(hN1_Hcal_MaxTiming, i, hcalMaxTiming );
+    //       fill(hN1_Hcal_MaxSector, i, hcalMaxSector );
     //     }
-    
-    // histograms_.fill("N1_LinRegNew", i, vetoNew.getNLinRegTracks() );
-    // histograms_.fill("N1_EpAng", i, vetoNew.getEPAng() );
-    // histograms_.fill("N1_EpSep", i, vetoNew.getEPSep() );
-    // histograms_.fill("N1_FirstNearPhLayer", i, vetoNew.getFirstNearPhLayer() );
-    // histograms_.fill("N1_XStd", i, vetoNew.getXStd() );
-    // histograms_.fill("N1_AvgLayerHit", i, vetoNew.getAvgLayerHit() );
-    // histograms_.fill("N1_DeepestLayerHit", i, vetoNew.getDeepestLayerHit() );
+  
+    // fill(hN1_LinRegNew, i, vetoNew.getNLinRegTracks() );
+    // fill(hN1_EpAng, i, vetoNew.getEPAng() );
+    // fill(hN1_EpSep, i, vetoNew.getEPSep() );
+    // fill(hN1_FirstNearPhLayer, i, vetoNew.getFirstNearPhLayer() );
+    // fill(hN1_XStd, i, vetoNew.getXStd() );
+    // fill(hN1_AvgLayerHit, i, vetoNew.getAvgLayerHit() );
+    // fill(hN1_DeepestLayerHit, i, vetoNew.getDeepestLayerHit() );
   //  }
   // }
 }
@@ -1099,20 +2469,4 @@ bool CutBasedDM::passPreselection(T (&passedCutsArray)[n], bool verbose) {
   }
 }
 
-std::tuple<int, const ldmx::SimParticle *> CutBasedDM::getRecoilEle(
-    const std::map<int, ldmx::SimParticle> &particleMap) {
-  // The recoil electron is "produced" in the dark brem geneartion
-  for (const auto &[trackID, particle] : particleMap) {
-    if (particle.getPdgID() == 11 and particle.getProcessType() == ldmx::SimParticle::ProcessType::eDarkBrem) {
-      return {trackID, &particle};
-    }   
-  }
-
-  // // only get here if recoil electron was not "produced" by dark brem
-  // //   in this case (bkgd), we interpret the primary electron as also the recoil
-  // //   electron
-  // ldmx::SimParticle::ProcessType::Primary
-  return {1, &(particleMap.at(1))};
-}
-
 DECLARE_ANALYZER(CutBasedDM);
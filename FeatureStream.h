@@ -0,0 +1,101 @@
+#ifndef FEATURESTREAM_H
+#define FEATURESTREAM_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Streams per-event feature values to a file or, for a destination
+// "unix:<path>", to a local Unix socket (cutQueryDaemon.py). The stream is a
+// text header
+//   FEATURES 1 <number of columns>\n<column names separated by spaces>\n
+// followed by chunks of up to kChunkEvents events: uint32 number of events,
+// then every column as that many little-endian float32 values.
+class FeatureStream {
+public:
+  static constexpr uint32_t kChunkEvents{4096};
+
+  // Throws std::runtime_error if the destination can't be opened
+  FeatureStream(const std::string &destination, const std::vector<std::string> &columns)
+  : columns_(columns.size()) {
+    if (destination.rfind("unix:", 0) == 0) {
+      std::string path{destination.substr(5)};
+      sockaddr_un address{};
+      address.sun_family = AF_UNIX;
+      if (path.size() >= sizeof(address.sun_path)) throw std::runtime_error("Socket path too long: " + path);
+      std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+      fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (fd_ < 0 || connect(fd_, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+        std::string error{strerror(errno)};
+        if (fd_ >= 0) ::close(fd_);
+        throw std::runtime_error("Cannot connect to " + path + ": " + error);
+      }
+      socket_ = true;
+    } else {
+      fd_ = ::open(destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (fd_ < 0) throw std::runtime_error("Cannot open " + destination + ": " + strerror(errno));
+    }
+    std::string header{"FEATURES 1 " + std::to_string(columns.size()) + "\n"};
+    for (std::size_t i = 0; i < columns.size(); i++) header += (i ? " " : "") + columns[i];
+    header += "\n";
+    write(header.data(), header.size());
+    chunk_.resize(columns_ * kChunkEvents);
+  }
+
+  ~FeatureStream() {
+    flush();
+    if (fd_ >= 0) ::close(fd_);
+  }
+
+  FeatureStream(const FeatureStream &) = delete;
+  FeatureStream &operator=(const FeatureStream &) = delete;
+
+  // One value per column
+  void push(const double *values) {
+    for (std::size_t c = 0; c < columns_; c++) chunk_[c * kChunkEvents + n_] = values[c];
+    if (++n_ == kChunkEvents) flush();
+  }
+
+  void flush() {
+    if (n_ == 0) return;
+    write(&n_, sizeof(n_));
+    for (std::size_t c = 0; c < columns_; c++) write(&chunk_[c * kChunkEvents], n_ * sizeof(float));
+    n_ = 0;
+  }
+
+  // False once a write failed, nothing is sent after that
+  bool good() const { return good_; }
+
+private:
+  void write(const void *data, std::size_t size) {
+    const char *p{static_cast<const char *>(data)};
+    while (good_ && size > 0) {
+      // A daemon going away must not kill the job with SIGPIPE
+      ssize_t n = socket_ ? ::send(fd_, p, size, MSG_NOSIGNAL) : ::write(fd_, p, size);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) {
+        good_ = false;
+        break;
+      }
+      p += n;
+      size -= n;
+    }
+  }
+
+  std::size_t columns_;
+  int fd_{-1};
+  bool socket_{false};
+  bool good_{true};
+  uint32_t n_{0};
+  std::vector<float> chunk_;
+};
+
+#endif
@@ -0,0 +1,188 @@
+#ifndef INPUTPREFETCHER_H
+#define INPUTPREFETCHER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Reads the next input files ahead of the event loop on a background thread,
+// so that opening them and fetching the first baskets hits the page cache
+// instead of the shared file system. At most `depth` files after the current
+// one and `budget` bytes are prefetched; a file is dropped from the cache
+// again once it was processed; a read the event loop overtook is stopped.
+// Files whose ROOT header doesn't match their size are not read and reported
+// as corrupted, files that can't be opened locally (e.g. remote URLs,
+// permissions) as unreadable. Both are still handed to the framework, which
+// only skips the ones ROOT fails to open with skipCorruptedInputFiles.
+class InputPrefetcher {
+public:
+  InputPrefetcher(const std::vector<std::string> &files, int depth, int64_t budget)
+  : files_(files), depth_(depth), budget_(budget) {
+    worker_ = std::thread([this] { run(); });
+  }
+
+  ~InputPrefetcher() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_all();
+    worker_.join();
+  }
+
+  // The event loop moved on to `file`, prefetch the ones after it
+  void opened(const std::string &file) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (std::size_t i{0}; i < files_.size(); i++) {
+      if (files_[i] == file) current_ = i;
+    }
+    wake_.notify_all();
+  }
+
+  // Done with `file`, hand its pages back
+  void closed(const std::string &file) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      for (std::size_t i{0}; i < files_.size(); i++) {
+        if (files_[i] != file) continue;
+        // A read still in flight would fill the cache again after the drop
+        readDone_.wait(lock, [&] { return reading_ != i; });
+        if (prefetched_.erase(i)) inCache_ -= sizes_[i];
+      }
+    }
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd >= 0) {
+      posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+      ::close(fd);
+    }
+    wake_.notify_all();
+  }
+
+  std::vector<std::string> corrupted() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::string> names;
+    for (auto i : corrupted_) names.push_back(files_[i]);
+    return names;
+  }
+
+  std::vector<std::string> unreadable() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::string> names;
+    for (auto i : unreadable_) names.push_back(files_[i]);
+    return names;
+  }
+
+  int64_t bytesPrefetched() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytesPrefetched_;
+  }
+
+private:
+  // Compare fEND from the ROOT file header with the size on disk: a file
+  // that wasn't closed properly or got truncated doesn't match
+  static bool looksIntact(int fd, int64_t size) {
+    unsigned char header[20];
+    if (pread(fd, header, sizeof(header), 0) != (ssize_t)sizeof(header)) return false;
+    if (std::memcmp(header, "root", 4) != 0) return false;
+    auto be32 = [&](int at) {
+      return (uint32_t(header[at]) << 24) | (uint32_t(header[at + 1]) << 16) | (uint32_t(header[at + 2]) << 8) | uint32_t(header[at + 3]);
+    };
+    int64_t end = be32(4) >= 1000000 ? (int64_t(be32(12)) << 32) | be32(16) : int64_t(be32(12));
+    return end == size;
+  }
+
+  void run() {
+    std::vector<char> buffer(4 << 20);
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stop_) {
+      // Next file in the window that wasn't looked at yet
+      std::size_t next{files_.size()};
+      for (std::size_t i{current_ + 1}; i < files_.size() && i <= current_ + depth_; i++) {
+        if (!prefetched_.count(i) && !corrupted_.count(i) && !unreadable_.count(i) && !tried_.count(i)) {
+          next = i;
+          break;
+        }
+      }
+      if (next == files_.size()) {
+        wake_.wait(lock);
+        continue;
+      }
+      tried_.insert(next);
+      std::string file{files_[next]};
+      lock.unlock();
+
+      bool opened{false}, intact{false};
+      int64_t size{0};
+      int fd = ::open(file.c_str(), O_RDONLY);
+      struct stat st;
+      if (fd >= 0 && fstat(fd, &st) == 0) {
+        opened = true;
+        size = st.st_size;
+        intact = looksIntact(fd, size);
+      }
+
+      lock.lock();
+      if (!opened) {
+        unreadable_.insert(next);
+      } else if (!intact) {
+        corrupted_.insert(next);
+      } else if (inCache_ + size <= budget_) {
+        inCache_ += size;
+        sizes_[next] = size;
+        prefetched_.insert(next);
+        reading_ = next;
+        lock.unlock();
+        // Ask for kernel read-ahead and pull the data through in large reads,
+        // the latter is what actually fills the cache on network file systems.
+        // Stop once the event loop got to the file itself.
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        int64_t offset{0};
+        ssize_t n;
+        while (!stop_ && current_ < next && (n = pread(fd, buffer.data(), buffer.size(), offset)) > 0) offset += n;
+        lock.lock();
+        bytesPrefetched_ += offset;
+        reading_ = files_.size();
+        readDone_.notify_all();
+      } else {
+        // Over budget: retry once earlier files are closed
+        tried_.erase(next);
+        if (fd >= 0) ::close(fd);
+        wake_.wait(lock);
+        continue;
+      }
+      if (fd >= 0) ::close(fd);
+    }
+  }
+
+  std::vector<std::string> files_;
+  std::size_t depth_;
+  int64_t budget_;
+  std::atomic<std::size_t> current_{0};
+  // File the worker is reading, files_.size() for none
+  std::size_t reading_{files_.size()};
+  std::set<std::size_t> tried_;
+  std::set<std::size_t> prefetched_;
+  std::set<std::size_t> corrupted_;
+  std::set<std::size_t> unreadable_;
+  std::map<std::size_t, int64_t> sizes_;
+  int64_t inCache_{0};
+  int64_t bytesPrefetched_{0};
+  std::atomic<bool> stop_{false};
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable readDone_;
+  std::thread worker_;
+};
+
+#endif
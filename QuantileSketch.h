@@ -0,0 +1,66 @@
+#ifndef QUANTILESKETCH_H
+#define QUANTILESKETCH_H
+
+#include <math.h>
+#include <sstream>
+#include <string>
+
+// Bucket layout of a log-bucketed streaming quantile sketch (DDSketch-like).
+// A value x is counted in bucket k = ceil(log_gamma |x|) with
+// gamma = (1 + alpha) / (1 - alpha), so every quantile read back is within a
+// relative error alpha of the true value, in the tails as well. The layout
+// only depends on (alpha, minValue, maxValue), so sketches stored as plain
+// TH1D bucket counts merge exactly with hadd.
+//
+// Buckets, in increasing value order:
+//   0 .. n-1          negative values, -maxValue .. -minValue
+//   n                 |x| < minValue
+//   n+1 .. 2n         positive values, minValue .. maxValue
+// Values beyond +-maxValue land in the under- / overflow bucket (-1 / 2n+1).
+class QuantileSketchLayout {
+public:
+  QuantileSketchLayout(double alpha = 0.01, double minValue = 1e-3, double maxValue = 1e6)
+  : alpha_(alpha), minValue_(minValue), maxValue_(maxValue) {
+    gamma_ = (1. + alpha_) / (1. - alpha_);
+    logGamma_ = log(gamma_);
+    kMin_ = (int)ceil(log(minValue_) / logGamma_);
+    nPerSign_ = (int)ceil(log(maxValue_) / logGamma_) - kMin_ + 1;
+  }
+
+  int nBuckets() const { return 2 * nPerSign_ + 1; }
+
+  // Bucket index of x, -1 / nBuckets() for under- / overflow
+  int index(double x) const {
+    double ax = fabs(x);
+    if (ax < minValue_) return nPerSign_;
+    int offset = (int)ceil(log(ax) / logGamma_) - kMin_;
+    if (offset >= nPerSign_) return x > 0 ? nBuckets() : -1;
+    return x > 0 ? nPerSign_ + 1 + offset : nPerSign_ - 1 - offset;
+  }
+
+  // Value represented by a bucket, within alpha of anything counted in it
+  double value(int idx) const {
+    if (idx == nPerSign_) return 0.;
+    int offset = idx > nPerSign_ ? idx - nPerSign_ - 1 : nPerSign_ - 1 - idx;
+    double v = 2. * pow(gamma_, kMin_ + offset) / (gamma_ + 1.);
+    return idx > nPerSign_ ? v : -v;
+  }
+
+  // Stored as the histogram title so readers can rebuild the layout
+  std::string title() const {
+    std::ostringstream ss;
+    ss << "QuantileSketch alpha=" << alpha_ << " min=" << minValue_ << " max=" << maxValue_;
+    return ss.str();
+  }
+
+private:
+  double alpha_;
+  double minValue_;
+  double maxValue_;
+  double gamma_;
+  double logGamma_;
+  int kMin_;
+  int nPerSign_;
+};
+
+#endif
@@ -0,0 +1,283 @@
+#ifndef SHAREDHISTOGRAMSTORE_H
+#define SHAREDHISTOGRAMSTORE_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Histogram contents shared by the analyzer processes of one node through a
+// POSIX shared memory segment. Every process attaches to the segment of the
+// same name and adds its fills to it with atomic (compare-and-swap) updates,
+// so no process keeps a private copy. The last process to finish gets the
+// accumulated contents to write out and removes the segment.
+//
+// Attaching, finishing and removing are serialised by flock() on a lock file
+// next to the segment, which the kernel releases if a process dies. The lock
+// file is removed along with the segment. A
+// participant that died without finishing is not waited for; what it filled
+// so far stays in the sums and it is reported as crashed. A segment left
+// behind with no live participant is discarded by the next process.
+//
+// Each region is a 2D histogram with ROOT's layout: (nX + 2) x (nY + 2)
+// cells including under- / overflow, sum of weights and sum of squared
+// weights per cell, and the statistics of TH1::GetStats().
+class SharedHistogramStore {
+public:
+  struct Axis {
+    int n;
+    double min;
+    double max;
+  };
+  struct Region {
+    Axis x;
+    Axis y;
+  };
+  enum ParticipantState : int32_t { kFree, kActive, kDone };
+  struct Participant {
+    int32_t pid;
+    int32_t state;
+    uint64_t events;
+  };
+  static constexpr int kMaxParticipants{256};
+  static constexpr int kNStats{7};
+
+  // Throws std::runtime_error if the segment can't be used. `tag` is hashed
+  // along with the regions: processes only share a segment with the same layout
+  SharedHistogramStore(const std::string &name, const std::vector<Region> &regions, const std::string &tag)
+  : name_(name.front() == '/' ? name : "/" + name), regions_(regions) {
+    uint64_t hash{layoutHash(tag)};
+    offsets_.push_back(0);
+    for (const auto &r : regions_) offsets_.push_back(offsets_.back() + uint64_t(r.x.n + 2) * (r.y.n + 2));
+    size_ = sizeof(Header) + regions_.size() * sizeof(RegionHeader) + 2 * offsets_.back() * sizeof(double);
+
+    lockPath_ = "/dev/shm" + name_ + ".lock";
+    while (true) {
+      lockFd_ = ::open(lockPath_.c_str(), O_RDWR | O_CREAT, 0600);
+      if (lockFd_ < 0) throw std::runtime_error("Cannot open the lock file of " + name_ + ": " + strerror(errno));
+      flock(lockFd_, LOCK_EX);
+      // release() may have removed the file while we waited, lock the new one then
+      struct stat locked, current;
+      if (fstat(lockFd_, &locked) == 0 && stat(lockPath_.c_str(), &current) == 0 && locked.st_ino == current.st_ino &&
+          locked.st_dev == current.st_dev) {
+        break;
+      }
+      ::close(lockFd_);
+    }
+    Unlock unlock{lockFd_};
+
+    int fd = shm_open(name_.c_str(), O_RDWR, 0);
+    if (fd >= 0) {
+      struct stat st;
+      void *mem{fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(Header) ? mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED};
+      auto header{static_cast<Header *>(mem)};
+      if (mem == MAP_FAILED || header->magic != kMagic || header->written || !anyAlive(header)) {
+        // Left over from an earlier set of jobs
+        if (mem != MAP_FAILED) munmap(mem, st.st_size);
+        ::close(fd);
+        shm_unlink(name_.c_str());
+        fd = -1;
+      } else if (header->layoutHash != hash || uint64_t(st.st_size) != size_) {
+        munmap(mem, st.st_size);
+        ::close(fd);
+        fail("Shared histograms " + name_ + " are in use with a different layout");
+      } else {
+        mem_ = mem;
+      }
+    }
+    if (fd < 0) {
+      fd = shm_open(name_.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+      if (fd < 0 || ftruncate(fd, size_) != 0) {
+        std::string error{strerror(errno)};
+        if (fd >= 0) ::close(fd);
+        shm_unlink(name_.c_str());
+        fail("Cannot create shared histograms " + name_ + ": " + error);
+      }
+      mem_ = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (mem_ == MAP_FAILED) {
+        mem_ = nullptr;
+        ::close(fd);
+        shm_unlink(name_.c_str());
+        fail("Cannot map shared histograms " + name_ + ": " + strerror(errno));
+      }
+      // ftruncate() zero-fills, only the header needs setting
+      header()->magic = kMagic;
+      header()->layoutHash = hash;
+    }
+    ::close(fd);
+
+    for (int i = 0; i < kMaxParticipants && slot_ < 0; i++) {
+      if (header()->participants[i].state == kFree) slot_ = i;
+    }
+    if (slot_ < 0) fail("Too many processes share histograms " + name_);
+    header()->participants[slot_] = {int32_t(getpid()), kActive, 0};
+  }
+
+  ~SharedHistogramStore() { close(); }
+
+  SharedHistogramStore(const SharedHistogramStore &) = delete;
+  SharedHistogramStore &operator=(const SharedHistogramStore &) = delete;
+
+  // Same bin finding and statistics as TH2::Fill(x, y, w)
+  void fill(int region, double x, double y, double w) {
+    const Region &r{regions_[region]};
+    int binX{findBin(r.x, x)}, binY{findBin(r.y, y)};
+    uint64_t cell{offsets_[region] + uint64_t(binY) * (r.x.n + 2) + binX};
+    RegionHeader &rh{regionHeader(region)};
+    __atomic_fetch_add(&rh.entries, 1, __ATOMIC_RELAXED);
+    if (w != 1. && !__atomic_load_n(&rh.weighted, __ATOMIC_RELAXED)) __atomic_store_n(&rh.weighted, 1, __ATOMIC_RELAXED);
+    atomicAdd(&sumw()[cell], w);
+    atomicAdd(&sumw2()[cell], w * w);
+    if (binX == 0 || binX > r.x.n || binY == 0 || binY > r.y.n) return;
+    double stats[kNStats]{w, w * w, w * x, w * x * x, w * y, w * y * y, w * x * y};
+    for (int i = 0; i < kNStats; i++) atomicAdd(&rh.stats[i], stats[i]);
+  }
+
+  // Done filling after `events` events. Returns true if no other live
+  // process still fills, the caller then reads the contents out and calls
+  // release(); the lock is kept until then so no one attaches meanwhile.
+  bool finish(uint64_t events) {
+    lock_ = flock(lockFd_, LOCK_EX) == 0;
+    Participant &self{header()->participants[slot_]};
+    self.events = events;
+    __atomic_store_n(&self.state, kDone, __ATOMIC_SEQ_CST);
+    if (anyAlive(header())) {
+      unlock();
+      return false;
+    }
+    return true;
+  }
+
+  // Marks the contents as written and removes the segment and the lock file
+  void release() {
+    header()->written = 1;
+    shm_unlink(name_.c_str());
+    ::unlink(lockPath_.c_str());
+    unlock();
+  }
+
+  int nRegions() const { return regions_.size(); }
+  const Region &region(int r) const { return regions_[r]; }
+  uint64_t entries(int r) const { return regionHeader(r).entries; }
+  bool weighted(int r) const { return regionHeader(r).weighted; }
+  const double *stats(int r) const { return regionHeader(r).stats; }
+  // Indexed by ROOT's global bin number
+  const double *sumw(int r) const { return sumw() + offsets_[r]; }
+  const double *sumw2(int r) const { return sumw2() + offsets_[r]; }
+
+  // Everyone who took part; a kActive one at this point has crashed
+  std::vector<Participant> participants() const {
+    std::vector<Participant> result;
+    for (const auto &p : header()->participants) {
+      if (p.state != kFree) result.push_back(p);
+    }
+    return result;
+  }
+
+private:
+  static constexpr uint64_t kMagic{0x5348415245444831ULL};
+  struct Header {
+    uint64_t magic;
+    uint64_t layoutHash;
+    uint32_t written;
+    Participant participants[kMaxParticipants];
+  };
+  struct RegionHeader {
+    uint64_t entries;
+    uint32_t weighted;
+    double stats[kNStats];
+  };
+
+  // Gives up the lock taken on fd at the end of the scope
+  struct Unlock {
+    ~Unlock() { flock(fd_, LOCK_UN); }
+    int fd_;
+  };
+
+  static void atomicAdd(double *target, double value) {
+    double expected, desired;
+    __atomic_load(target, &expected, __ATOMIC_RELAXED);
+    do {
+      desired = expected + value;
+    } while (!__atomic_compare_exchange(target, &expected, &desired, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  }
+
+  static int findBin(const Axis &a, double v) {
+    if (v < a.min) return 0;
+    if (!(v < a.max)) return a.n + 1;
+    return 1 + int(a.n * (v - a.min) / (a.max - a.min));
+  }
+
+  // Another participant that didn't finish and whose process still exists
+  static bool anyAlive(const Header *header) {
+    for (const auto &p : header->participants) {
+      if (p.state == kActive && p.pid != getpid() && (kill(p.pid, 0) == 0 || errno == EPERM)) return true;
+    }
+    return false;
+  }
+
+  uint64_t layoutHash(const std::string &tag) const {
+    // FNV-1a
+    uint64_t hash{0xcbf29ce484222325ULL};
+    auto add = [&](const void *data, std::size_t n) {
+      for (std::size_t i = 0; i < n; i++) hash = (hash ^ static_cast<const unsigned char *>(data)[i]) * 0x100000001b3ULL;
+    };
+    add(tag.data(), tag.size());
+    for (const auto &r : regions_) {
+      for (const Axis &a : {r.x, r.y}) {
+        add(&a.n, sizeof(a.n));
+        add(&a.min, sizeof(a.min));
+        add(&a.max, sizeof(a.max));
+      }
+    }
+    return hash;
+  }
+
+  void close() {
+    if (mem_) munmap(mem_, size_);
+    mem_ = nullptr;
+    if (lockFd_ >= 0) ::close(lockFd_);
+    lockFd_ = -1;
+  }
+
+  // The destructor doesn't run for a throwing constructor
+  [[noreturn]] void fail(const std::string &message) {
+    close();
+    throw std::runtime_error(message);
+  }
+
+  void unlock() {
+    if (lock_) flock(lockFd_, LOCK_UN);
+    lock_ = false;
+  }
+
+  Header *header() const { return static_cast<Header *>(mem_); }
+  RegionHeader &regionHeader(int r) const {
+    return reinterpret_cast<RegionHeader *>(static_cast<char *>(mem_) + sizeof(Header))[r];
+  }
+  double *sumw() const {
+    return reinterpret_cast<double *>(static_cast<char *>(mem_) + sizeof(Header) + regions_.size() * sizeof(RegionHeader));
+  }
+  double *sumw2() const { return sumw() + offsets_.back(); }
+
+  std::string name_;
+  std::string lockPath_;
+  std::vector<Region> regions_;
+  std::vector<uint64_t> offsets_;
+  uint64_t size_;
+  int lockFd_{-1};
+  bool lock_{false};
+  void *mem_{nullptr};
+  int slot_{-1};
+};
+
+#endif
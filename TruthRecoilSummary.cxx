@@ -0,0 +1,33 @@
+#include "Framework/EventProcessor.h"
+#include "TruthRecoilSummary.h"
+
+// Writes the recoil electron truth kinematics as a fixed-size float
+// collection (see TruthRecoilIndex), meant to run once at sim or skim time.
+// CutBasedDM picks it up when present instead of loading SimParticles.
+
+class TruthRecoilSummary : public framework::Producer {
+public:
+  TruthRecoilSummary(const std::string& name, framework::Process& p)
+  : framework::Producer(name, p) {}
+  ~TruthRecoilSummary() = default;
+  void configure(framework::config::Parameters &ps);
+  void produce(framework::Event& event) final;
+  std::string sp_pass_name_;
+  std::string collection_name_;
+};
+
+
+void TruthRecoilSummary::configure(framework::config::Parameters &ps) {
+  sp_pass_name_ = ps.getParameter<std::string>("sp_pass_name", "");
+  collection_name_ = ps.getParameter<std::string>("collection_name", "TruthRecoilSummary");
+
+  return;
+}
+
+void TruthRecoilSummary::produce(framework::Event& event) {
+  auto particleMap{event.getMap<int, ldmx::SimParticle>("SimParticles")};
+  auto targetSpHits{event.getCollection<ldmx::SimTrackerHit>("TargetScoringPlaneHits",sp_pass_name_)};
+  event.add(collection_name_, computeTruthRecoilSummary(particleMap, targetSpHits));
+}
+
+DECLARE_PRODUCER(TruthRecoilSummary);
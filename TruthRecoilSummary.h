@@ -0,0 +1,91 @@
+#ifndef TRUTHRECOILSUMMARY_H
+#define TRUTHRECOILSUMMARY_H
+
+#include "SimCore/Event/SimParticle.h"
+#include "DetDescr/SimSpecialID.h"
+#include "SimCore/Event/SimTrackerHit.h"
+
+#include <map>
+#include <tuple>
+#include <vector>
+#include <math.h>
+
+// Fixed layout of the "TruthRecoilSummary" float collection.
+// Written once by the TruthRecoilSummary producer so that analysis passes
+// don't have to deserialize SimParticles and TargetScoringPlaneHits.
+enum TruthRecoilIndex {
+  kTruthPT = 0,          // recoil electron truth p_T [MeV]
+  kTruthPZ,              // recoil electron truth p_Z [MeV]
+  kTruthP,               // recoil electron truth |p| [MeV]
+  kTruthXAtTarget,       // X @Target SP [mm]
+  kTruthPTAtTarget,      // p_T @Target SP [MeV]
+  kTruthPZAtTarget,      // p_Z @Target SP [MeV]
+  kTruthPAtTarget,       // |p| @Target SP [MeV]
+  kTruthThetaAtTarget,   // theta @Target SP [deg]
+  kTruthPhiAtTarget,     // phi @Target SP [deg]
+  kNTruthRecoil
+};
+
+inline std::tuple<int, const ldmx::SimParticle *> getRecoilEle(
+    const std::map<int, ldmx::SimParticle> &particleMap) {
+  // The recoil electron is "produced" in the dark brem geneartion
+  for (const auto &[trackID, particle] : particleMap) {
+    if (particle.getPdgID() == 11 and particle.getProcessType() == ldmx::SimParticle::ProcessType::eDarkBrem) {
+      return {trackID, &particle};
+    }
+  }
+
+  // // only get here if recoil electron was not "produced" by dark brem
+  // //   in this case (bkgd), we interpret the primary electron as also the recoil
+  // //   electron
+  // ldmx::SimParticle::ProcessType::Primary
+  return {1, &(particleMap.at(1))};
+}
+
+// Recoil electron kinematics from the full truth collections, laid out as
+// TruthRecoilIndex. Used by the producer and as the analyzer fallback.
+inline std::vector<float> computeTruthRecoilSummary(
+    const std::map<int, ldmx::SimParticle> &particleMap,
+    const std::vector<ldmx::SimTrackerHit> &targetSpHits) {
+  std::vector<float> summary(kNTruthRecoil, -9999.);
+
+  // Take recoil momentum from SIM particles
+  auto [recoilTrackID, recoilElectron] = getRecoilEle(particleMap);
+  float pT = sqrt(recoilElectron->getMomentum()[0] * recoilElectron->getMomentum()[0] +  recoilElectron->getMomentum()[1] * recoilElectron->getMomentum()[1]);
+  float pZ = recoilElectron->getMomentum()[2];
+  summary[kTruthPT] = pT;
+  summary[kTruthPZ] = pZ;
+  summary[kTruthP] = sqrt(pT*pT + pZ*pZ);
+
+  //  Same but at the target SP
+  float XAtTarget{-9999};
+  float pTAtTarget{-9999.};
+  float pYAtTarget{-9999.};
+  float pZAtTarget{-9999.};
+  float totMomAtTarget{-9999.};
+  for (const ldmx::SimTrackerHit &spHit : targetSpHits) {
+    ldmx::SimSpecialID hit_id(spHit.getID());
+    if (hit_id.plane() != 1 || spHit.getMomentum()[2] <= 0) continue;
+
+    if (spHit.getTrackID() == recoilTrackID) {
+      float p_current = sqrt(spHit.getMomentum()[0]*spHit.getMomentum()[0] + spHit.getMomentum()[1]*spHit.getMomentum()[1] + spHit.getMomentum()[2]*spHit.getMomentum()[2]);
+      if (p_current > totMomAtTarget) {
+        pYAtTarget  = spHit.getMomentum()[1];
+        pTAtTarget = sqrt(spHit.getMomentum()[0]*spHit.getMomentum()[0] + spHit.getMomentum()[1]*spHit.getMomentum()[1]);
+        pZAtTarget = spHit.getMomentum()[2];
+        totMomAtTarget = p_current;
+        XAtTarget = spHit.getPosition()[0];
+      }
+    }
+  }
+  summary[kTruthXAtTarget] = XAtTarget;
+  summary[kTruthPTAtTarget] = pTAtTarget;
+  summary[kTruthPZAtTarget] = pZAtTarget;
+  summary[kTruthPAtTarget] = totMomAtTarget;
+  summary[kTruthThetaAtTarget] = (180/M_PI)*std::acos(pZAtTarget/totMomAtTarget);
+  summary[kTruthPhiAtTarget] = (180/M_PI)*std::acos(pYAtTarget/totMomAtTarget)-90.;
+
+  return summary;
+}
+
+#endif
@@ -0,0 +1,63 @@
+#!/usr/bin/env python
+# Per-stage efficiencies with bootstrap uncertainties from the
+# Bootstrap_<CutFlow> histograms written by CutBasedDM (bootstrap_replicas).
+# Works on single job outputs as well as on hadd-ed files.
+#
+# How to run example:
+# python3 bootstrapEfficiency.py signal_histo.root -f Tracking BDT -r 2
+import argparse
+import math
+
+import ROOT
+
+ROOT.gROOT.SetBatch(True)
+
+
+def collectReplicas(directory, found):
+    for key in directory.GetListOfKeys():
+        obj = key.ReadObj()
+        if obj.InheritsFrom("TDirectory"):
+            collectReplicas(obj, found)
+        elif key.GetName().startswith("Bootstrap_"):
+            found.append((directory.GetPath().split(":")[-1] + "/" + key.GetName(), obj))
+
+
+def stageEfficiencies(histo, refStage):
+    # Mean and standard deviation over the replicas of count(stage) / count(refStage)
+    nStages = histo.GetNbinsX()
+    nReplicas = histo.GetNbinsY()
+    result = []
+    for stage in range(1, nStages + 1):
+        effs = []
+        for replica in range(1, nReplicas + 1):
+            ref = histo.GetBinContent(refStage + 1, replica)
+            if ref > 0:
+                effs.append(histo.GetBinContent(stage, replica) / ref)
+        mean = sum(effs) / len(effs) if effs else 0.
+        std = math.sqrt(sum((e - mean) ** 2 for e in effs) / (len(effs) - 1)) if len(effs) > 1 else 0.
+        counts = [histo.GetBinContent(stage, replica) for replica in range(1, nReplicas + 1)]
+        result.append((histo.GetXaxis().GetBinLabel(stage), sum(counts) / nReplicas, mean, std))
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description='')
+    parser.add_argument('file', action='store')
+    parser.add_argument('-f', '--flows', action='store', dest='flows', nargs='+', default=[])
+    parser.add_argument('-r', '--reference-stage', action='store', dest='refStage', type=int, default=0,
+                        help='efficiencies are relative to this stage')
+    args = parser.parse_args()
+
+    found = []
+    collectReplicas(ROOT.TFile.Open(args.file), found)
+    for name, histo in sorted(found):
+        if args.flows and name.split("Bootstrap_")[-1] not in args.flows:
+            continue
+        print("%s (%d replicas)" % (name, histo.GetNbinsY()))
+        print("  %-5s %-30s %14s %14s %14s" % ("stage", "cut", "mean count", "efficiency", "bootstrap std"))
+        for stage, (label, count, eff, std) in enumerate(stageEfficiencies(histo, args.refStage)):
+            print("  %-5d %-30s %14.6g %14.6g %14.6g" % (stage, label, count, eff, std))
+
+
+if __name__ == "__main__" :
+    main()
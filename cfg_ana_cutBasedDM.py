@@ -27,7 +27,11 @@ print("Input files = ", p.inputFiles)
 #p.inputFiles = [f'ecalPnIn.root']
 #p.histogramFile = fileName[:-5] + "_histo_v4_nonfid.root"
 #p.histogramFile = "/sdf/group/ldmx/users/tamasvami/CutBasedDM/"  + str(fileName.split('/')[-2]) + "/" + str(fileName.split('/')[-1][:-5]) + "_histo_v16.root"
-p.histogramFile = "/home/vamitamas/CutBasedDM/"  + str(fileName.split('/')[-2]) + "/" + str(fileName.split('/')[-1][:-5]) + "_histo_v18.root"
+# regressionCheck.py points the output to its own scratch area
+if "CUTBASED_HISTO_FILE" in os.environ:
+    p.histogramFile = os.environ["CUTBASED_HISTO_FILE"]
+else:
+    p.histogramFile = "/home/vamitamas/CutBasedDM/"  + str(fileName.split('/')[-2]) + "/" + str(fileName.split('/')[-1][:-5]) + "_histo_v18.root"
 # p.histogramFile  = str(fileName.split('/')[-1][:-5]) + "_histo_v16.root"
 print("Histogram output = ", p.histogramFile)
 
@@ -65,15 +69,101 @@ hcalVeto   = hcal.HcalVetoProcessor('hcalVeto')
 # Trigger
 trigger = TriggerProcessor('Trigger', 8000.)
 
-cutBasedAna = ldmxcfg.Analyzer.from_file('CutBasedDM.cxx')
+class AnalysisVariant:
+    def __init__(self, name, fiducial_analysis, ignore_fiducial_analysis = False, ignore_tagger_analysis = False):
+        self.name = name
+        self.fiducial_analysis = fiducial_analysis
+        self.ignore_fiducial_analysis = ignore_fiducial_analysis
+        self.ignore_tagger_analysis = ignore_tagger_analysis
+
+# Compile once per source / compiler / framework version into a shared cache
+# (CUTBASED_LIB_CACHE), instead of in every job
+sys.path.insert(0, os.getcwd())
+from libraryCache import cachedFromFile
+cutBasedAna = cachedFromFile(ldmxcfg.Analyzer, 'CutBasedDM.cxx')
 #cutBasedAna.fiducial_analysis = False
 cutBasedAna.fiducial_analysis = True
 cutBasedAna.trigger_name = "Trigger"
 cutBasedAna.trigger_pass = "cutbased"
 cutBasedAna.signal = signal
 cutBasedAna.ignore_fiducial_analysis = False
+# Extra fiducial / tagger choices filled in the same pass, each one into a
+# sub-directory named after it, e.g.
+# cutBasedAna.variants = [AnalysisVariant('NonFiducial', fiducial_analysis = False),
+#                         AnalysisVariant('IgnoreFiducial', fiducial_analysis = True, ignore_fiducial_analysis = True)]
 cutBasedAna.sp_pass_name = sp_pass_temp
 cutBasedAna.recoil_track_collection = 'RecoilTracksClean'
+# Compact recoil truth, read instead of SimParticles when found in the input
+cutBasedAna.truth_summary_collection = 'TruthRecoilSummary'
+cutBasedAna.truth_summary_pass = ''
+# Mergeable quantile sketches per CnC stage, read back with sketchQuantiles.py,
+# e.g. cutBasedAna.quantile_variables = ['SummedTightIso', 'SummedDet', 'HcalMaxPE', 'HcalTotalPE', 'TruthP']
+cutBasedAna.quantile_variables = []
+cutBasedAna.quantile_alpha = 0.01
+# Fast iterations: e.g. 0.01 keeps a reproducible 1% of the events (all
+# triggered ones with sample_keep_triggered) and weights the fills accordingly
+cutBasedAna.sample_fraction = 1.0
+cutBasedAna.sample_keep_triggered = True
+cutBasedAna.sample_seed = 0
+# Read the next prefetch_depth input files into the page cache while the
+# current one is processed, can help on the shared file systems (0 is off).
+# It reads every byte of the files, so not with read_declared_inputs_only.
+cutBasedAna.prefetch_files = p.inputFiles
+cutBasedAna.prefetch_depth = 0
+cutBasedAna.prefetch_budget_mb = 2000
+# Live job metrics (Prometheus text format), rewritten every metrics_period_s,
+# e.g. cutBasedAna.metrics_file = f'metrics_{os.environ.get("SLURM_JOB_ID", "local")}.prom'
+# (regressionCheck.py times the event loop with it)
+cutBasedAna.metrics_file = os.environ.get("CUTBASED_METRICS_FILE", '')
+cutBasedAna.metrics_period_s = 30.
+# Buffer events in blocks of batch_size and run the cuts and fills per block,
+# same output as the per-event mode (0)
+cutBasedAna.batch_size = int(os.environ.get("CUTBASED_BATCH_SIZE", "0"))
+# Poisson bootstrap replicas of the cut-flow stage counts, for efficiency
+# uncertainties with bootstrapEfficiency.py (0 switches them off)
+cutBasedAna.bootstrap_replicas = 0
+cutBasedAna.bootstrap_flows = ['BDT', 'Tracking', 'TrackingHcal']
+cutBasedAna.bootstrap_seed = 0
+# Pass-pattern histograms of these cut flows (2^number of cuts bins), for any
+# cut order, N-1 yields and correlations offline with cutPatterns.py (flows
+# of up to 13 cuts, not CnCWithTracking); optionally also vs one variable,
+# coarsely binned
+cutBasedAna.pattern_flows = []
+cutBasedAna.pattern_variable = ''
+cutBasedAna.pattern_variable_bins = 10
+cutBasedAna.pattern_variable_min = 0.
+cutBasedAna.pattern_variable_max = 1.
+# Derive the binning of the variable axes from the fills of the first
+# adaptive_warmup_events kept events. The binning is stored as
+# <analyzer>/AdaptiveBinning in the output; jobs to be hadd-ed together should
+# read it from one reference output with adaptive_binning_file instead.
+cutBasedAna.adaptive_binning = False
+cutBasedAna.adaptive_warmup_events = 5000
+cutBasedAna.adaptive_buffer_mb = 200.
+cutBasedAna.adaptive_memory_mb = 500.
+cutBasedAna.adaptive_binning_file = ''
+# Sorted (run, event, passed cuts) record of every kept event, to compare
+# analyzer versions event by event with diffCutRecords.py ('' switches it off)
+cutBasedAna.cut_record_file = ''
+# Fill the histograms into a shared memory segment of this name, shared by all
+# jobs on the node given the same name; the last one to finish writes them
+# (the others' files only hold the per-process extras), e.g.
+# cutBasedAna.shared_histograms = f'cutbased_{os.environ.get("SLURM_JOB_ID", "local")}'
+cutBasedAna.shared_histograms = ''
+# Hand the histogram fills to a worker thread through a ring buffer of this
+# many records (0 fills on the event thread), same output either way
+cutBasedAna.async_fill_buffer = 0
+# Stream the features of every event to a file or to cutQueryDaemon.py for
+# interactive cut queries, e.g. 'unix:/tmp/cutq_ingest.sock' ('' is off)
+cutBasedAna.feature_stream = ''
+
+# Set to True in sim / skim configs to write the TruthRecoilSummary once
+produce_truth_summary = False
+truthSummary = []
+if produce_truth_summary:
+    truthSummaryProd = cachedFromFile(ldmxcfg.Producer, 'TruthRecoilSummary.cxx')
+    truthSummaryProd.sp_pass_name = sp_pass_temp
+    truthSummary = [truthSummaryProd]
 p.sequence = []
 
 from LDMX.Tracking import full_tracking_sequence
@@ -111,6 +201,14 @@ p.sequence.extend(track_sqs_1)
 p.sequence.extend(track_sqs_2)
 p.sequence.extend(accaptance)
 
+p.sequence.extend(truthSummary)
 p.sequence.extend([ecalVeto, hcalVeto, trigger])
 p.sequence.extend([cutBasedAna])
 
+# Re-analysis of files that already carry the veto, trigger and track products:
+# skip the producers and read only the branches declared by CutBasedDM
+analysis_only = False
+if analysis_only:
+    p.sequence = [cutBasedAna]
+    cutBasedAna.read_declared_inputs_only = True
+
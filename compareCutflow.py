@@ -30,6 +30,10 @@ for i in range(0, fileIn.GetListOfKeys().GetEntries()):
           ROOT.gStyle.SetPadBottomMargin(0.14);
           ROOT.gStyle.SetPadLeftMargin(0.15);
           obj = fileIn.Get(newname)
+          # Sub-directories hold the extra analysis variants, and only
+          # histograms are plotted (not the AdaptiveBinning or
+          # SharedHistogramParticipants records)
+          if not obj.InheritsFrom("TH1") : continue
           obj.SetMarkerStyle(20)
           
           tex2 = ROOT.TLatex(0.15,0.92,"LDMX");
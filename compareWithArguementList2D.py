@@ -32,26 +32,34 @@ for sample in SamplesArray:
 
 #PostCutHistoBin = 13
 PostCutHistoBin = int(binIn)
-f = fileInArray[0]
+# Histograms are booked when first filled, so list those of every sample
+keyNames = []
+for f in fileInArray:
+  for i in range(0, f.GetListOfKeys().GetEntries()):
+    dirname = f.GetListOfKeys().At(i).GetName()
+    curr_dir = f.GetDirectory(dirname)
+#    print("dirname: "+dirname)
+    if not (curr_dir) :
+      continue
+    for j in range(0, curr_dir.GetListOfKeys().GetEntries()):
+      keyname = curr_dir.GetListOfKeys().At(j).GetName()
+      if not ((dirname, keyname) in keyNames) :
+        keyNames.append((dirname, keyname))
 
-for i in range(0, fileInArray[0].GetListOfKeys().GetEntries()):
-  dirname = f.GetListOfKeys().At(i).GetName()
-  curr_dir = f.GetDirectory(dirname)
-#  print("dirname: "+dirname)
-  if not (curr_dir) :
-    continue
-  for i in range(0, curr_dir.GetListOfKeys().GetEntries()):
+for i in range(0, len(keyNames)):
       # Match the plot of interest
-      keyname = curr_dir.GetListOfKeys().At(i).GetName()
+      dirname, keyname = keyNames[i]
       # if not ("CutFlow" in keyname):  continue
       keyname2 = keyname
-      curr_dir2 = f.GetDirectory(dirname+"/"+keyname)
       if True :
-          keyname = curr_dir.GetListOfKeys().At(i).GetName()
 #          print(dirname+"/"+keyname)
-          curr_dir2 = fileInArray[0].GetDirectory(dirname+"/"+keyname)
           newname = dirname+"/"+keyname
-          obj = fileInArray[0].Get(newname)
+          # From the first sample that has it
+          obj = next(fileIn.Get(newname) for fileIn in fileInArray if fileIn.Get(newname))
+          # Sub-directories hold the extra analysis variants, and only
+          # histograms are plotted (not the AdaptiveBinning or
+          # SharedHistogramParticipants records)
+          if not obj.InheritsFrom("TH1") : continue
           obj.SetMarkerStyle(20)
           
           tex2 = ROOT.TLatex(0.15,0.92,"LDMX");
@@ -118,25 +126,32 @@ for i in range(0, fileInArray[0].GetListOfKeys().GetEntries()):
                 legend.SetFillStyle(0);
                 
                 histoArray = []
+                # sample of each entry in histoArray, for its colour and legend
+                histoSampleIndex = []
                 # fake index to satisfy ROOT memory allocation
                 i = 0
                 for fileIn in fileInArray:
 #                  print(keyname)
+                  source = fileIn.Get(newname)
+                  # Histograms are booked when first filled, a sample may not have this one
+                  if not source :
+                    i += 1
+                    continue
                   if ("N1_" in keyname) :
-                    PostCutHisto = fileIn.Get(newname).ProjectionY(keyname2 + "_ProjY"+str(i),PostCutHistoBin,PostCutHistoBin)
+                    PostCutHisto = source.ProjectionY(keyname2 + "_ProjY"+str(i),PostCutHistoBin,PostCutHistoBin)
                   elif ("Rev_" in keyname) :
-                    PostCutHisto = fileIn.Get(newname).ProjectionY(keyname2 + "_ProjY"+str(i),PostCutHistoBin,PostCutHistoBin)
+                    PostCutHisto = source.ProjectionY(keyname2 + "_ProjY"+str(i),PostCutHistoBin,PostCutHistoBin)
                   elif  ("TrigEff" in keyname):
-                    PostCutHisto = fileIn.Get(newname).ProfileY(keyname2 + "_ProfY"+str(i))
+                    PostCutHisto = source.ProfileY(keyname2 + "_ProfY"+str(i))
                     for indexBin in range(1,PostCutHisto.GetNbinsX()):
                         if (PostCutHisto.GetBinError(indexBin) > 0.2 or PostCutHisto.GetBinError(indexBin) == 0 ) : PostCutHisto.SetBinContent(indexBin, -1.)
                   elif ("CutFlow" in keyname):
-                    PostCutHisto = fileIn.Get(newname).ProjectionX(keyname2 + "_ProjX"+str(i))
+                    PostCutHisto = source.ProjectionX(keyname2 + "_ProjX"+str(i))
                     PostCutHisto.LabelsOption("v")
                     # PostCutHisto.GetXaxis().SetBinLabel(2,"Non-fiducial")
 
                   else :
-                    PostCutHisto = fileIn.Get(newname).ProjectionY(keyname2 + "_ProjY"+str(i),PostCutHistoBin,PostCutHistoBin)
+                    PostCutHisto = source.ProjectionY(keyname2 + "_ProjY"+str(i),PostCutHistoBin,PostCutHistoBin)
                   
                   
                   if (PostCutHisto.Integral()> 0 and not "TrigEff" in keyname and not "CutFlow" in keyname) :
@@ -152,8 +167,10 @@ for i in range(0, fileInArray[0].GetListOfKeys().GetEntries()):
                       if bin_content == 0.0: continue
                       print(f"| {bin_label} | {bin_content} |")
 
+                  if (PostCutHisto) :
+                    histoArray.append(PostCutHisto)
+                    histoSampleIndex.append(i)
                   i += 1
-                  if (PostCutHisto) : histoArray.append(PostCutHisto)
                 for index in range(0, len(histoArray)):
                   histoArray[index].SetStats(0)
                   histoArray[index].SetMarkerStyle(20)
@@ -161,11 +178,12 @@ for i in range(0, fileInArray[0].GetListOfKeys().GetEntries()):
                   if ("PT" in keyname) :
                     histoArray[index].GetXaxis().SetRangeUser(0.0,1000.0)
 
-                  legendEntry = SamplesArray[index][0:SamplesArray[index].find(".root")]
+                  sampleIndex = histoSampleIndex[index]
+                  legendEntry = SamplesArray[sampleIndex][0:SamplesArray[sampleIndex].find(".root")]
                   legend.AddEntry(histoArray[index],legendEntry,"LP")
                   indexNew = -1
-                  if (index>-1):
-                    indexNew = index+2
+                  if (sampleIndex>-1):
+                    indexNew = sampleIndex+2
                   if (indexNew==10) :
                     indexNew = 40
                   elif (indexNew==11) :
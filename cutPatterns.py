@@ -0,0 +1,142 @@
+#!/usr/bin/env python
+# Cut flows in any order, N-1 yields and cut correlations from the
+# Pattern_<flow> histograms of CutBasedDM (pattern_flows): bin p+1 counts the
+# events whose cuts passed as the bits of p, bit i being the i-th cut in the
+# histogram title. Nothing has to be rerun for a new ordering, and hadd-ed
+# files work the same. With pattern_variable, Pattern_<flow>_vs_<variable>
+# also gives the distribution of that variable after any set of cuts.
+#
+# How to run example:
+# python3 cutPatterns.py signal_histo.root -f CnC -o Trigger Acceptance HcalVeto SummedDet --n-1 --correlations --variable
+import argparse
+import math
+
+import numpy
+import ROOT
+
+ROOT.gROOT.SetBatch(True)
+
+
+class PatternTable:
+    def __init__(self, cuts, counts, vsVariable=None, edges=None, variable=None):
+        self.cuts = cuts
+        self.counts = numpy.asarray(counts, dtype=float)
+        self.patterns = numpy.arange(len(self.counts))
+        # [pattern, bin] including under- / overflow, edges of the inner bins
+        self.vsVariable = vsVariable
+        self.edges = edges
+        self.variable = variable
+
+    def selected(self, cuts):
+        # Patterns passing all of the cuts
+        mask = 0
+        for cut in cuts:
+            mask |= 1 << self.cuts.index(cut)
+        return (self.patterns & mask) == mask
+
+    def passing(self, cuts):
+        return self.counts[self.selected(cuts)].sum()
+
+    def cutFlow(self, order):
+        # (cut, events passing it and all before, efficiency w.r.t. the previous stage)
+        flow, previous = [], self.counts.sum()
+        for i, cut in enumerate(order):
+            n = self.passing(order[:i + 1])
+            flow.append((cut, n, n / previous if previous else 0.))
+            previous = n
+        return flow
+
+    def nMinusOne(self, cuts):
+        # (cut, events passing all the other cuts, efficiency of the cut on those)
+        total = self.passing(cuts)
+        result = []
+        for cut in cuts:
+            others = self.passing([c for c in cuts if c != cut])
+            result.append((cut, others, total / others if others else 0.))
+        return result
+
+    def correlations(self, cuts):
+        # Weighted phi coefficient of the pass / fail outcomes of every pair
+        total = self.counts.sum()
+        p = [self.passing([c]) / total for c in cuts]
+        matrix = numpy.zeros((len(cuts), len(cuts)))
+        for i, a in enumerate(cuts):
+            for j, b in enumerate(cuts):
+                pab = self.passing([a, b]) / total
+                denominator = math.sqrt(p[i] * (1. - p[i]) * p[j] * (1. - p[j]))
+                matrix[i, j] = (pab - p[i] * p[j]) / denominator if denominator > 0 else float("nan")
+        return matrix
+
+    def distribution(self, cuts):
+        return self.vsVariable[self.selected(cuts)].sum(axis=0)
+
+
+def fromHistograms(counts, vsVariable=None):
+    cuts = counts.GetTitle().split(":", 1)[1].split()
+    table = PatternTable(cuts, [counts.GetBinContent(b) for b in range(1, counts.GetNbinsX() + 1)])
+    if vsVariable:
+        nY = vsVariable.GetNbinsY()
+        table.vsVariable = numpy.array([[vsVariable.GetBinContent(x, y) for y in range(0, nY + 2)]
+                                        for x in range(1, vsVariable.GetNbinsX() + 1)])
+        axis = vsVariable.GetYaxis()
+        table.edges = [axis.GetBinLowEdge(y) for y in range(1, nY + 2)]
+        table.variable = axis.GetTitle()
+    return table
+
+
+def collectPatterns(directory, flow, tables):
+    # path -> table of Pattern_<flow> and its _vs_ companion in every directory
+    keys = {key.GetName(): key for key in directory.GetListOfKeys()}
+    for name, key in keys.items():
+        obj = key.ReadObj()
+        if obj.InheritsFrom("TDirectory"):
+            collectPatterns(obj, flow, tables)
+        elif name == "Pattern_" + flow:
+            vs = [k.ReadObj() for n, k in keys.items() if n.startswith(name + "_vs_")]
+            tables[directory.GetPath().split(":")[-1]] = fromHistograms(obj, vs[0] if vs else None)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='')
+    parser.add_argument('file', action='store')
+    parser.add_argument('-f', '--flow', action='store', dest='flow', default='CnC')
+    parser.add_argument('-o', '--order', action='store', dest='order', nargs='+', default=[],
+                        help='cuts in the order to apply them, the recorded order by default')
+    parser.add_argument('--n-1', action='store_true', dest='nMinusOne')
+    parser.add_argument('--correlations', action='store_true', dest='correlations')
+    parser.add_argument('--variable', action='store_true', dest='variable',
+                        help='distribution of the pattern variable after all the cuts')
+    args = parser.parse_args()
+
+    tables = {}
+    collectPatterns(ROOT.TFile.Open(args.file), args.flow, tables)
+    if not tables:
+        print("No Pattern_%s histograms in %s" % (args.flow, args.file))
+    for path, table in sorted(tables.items()):
+        order = args.order or table.cuts
+        unknown = [c for c in order if c not in table.cuts]
+        if unknown:
+            print("%s: cuts %s not recorded, have %s" % (path, " ".join(unknown), " ".join(table.cuts)))
+            continue
+        print("\n%s: %.6g events" % (path, table.counts.sum()))
+        print("  %-20s %14s %10s" % ("cut", "events", "eff"))
+        for cut, n, eff in table.cutFlow(order):
+            print("  %-20s %14.6g %10.4f" % (cut, n, eff))
+        if args.nMinusOne:
+            print("  N-1 %-16s %14s %10s" % ("cut", "others pass", "eff"))
+            for cut, n, eff in table.nMinusOne(order):
+                print("      %-16s %14.6g %10.4f" % (cut, n, eff))
+        if args.correlations:
+            print("  Correlations of the cut outcomes")
+            print("  %-20s " % "" + " ".join("%6.6s" % c for c in order))
+            for cut, row in zip(order, table.correlations(order)):
+                print("  %-20s " % cut + " ".join("%6.2f" % r for r in row))
+        if args.variable and table.vsVariable is not None:
+            counts = table.distribution(order)
+            print("  %s after all cuts: underflow %.6g, overflow %.6g" % (table.variable, counts[0], counts[-1]))
+            for low, high, n in zip(table.edges[:-1], table.edges[1:], counts[1:-1]):
+                print("    [%10.4g, %10.4g) %14.6g" % (low, high, n))
+
+
+if __name__ == "__main__" :
+    main()
@@ -0,0 +1,335 @@
+#!/usr/bin/env python
+# In-memory cut queries over the per-event features CutBasedDM streams with
+# feature_stream (see FeatureStream.h). The daemon takes streams on a local
+# Unix socket (feature_stream = 'unix:<ingest socket>') and / or from files,
+# keeps them as columns in blocks of events, each column stored in the
+# narrowest type that holds it exactly (constant, int8, int16, int32 or
+# float32), and answers cut expressions on a second Unix socket. Blocks are
+# scanned in parallel threads with vectorised numpy, which releases the GIL.
+#
+# A query is a Python-like expression over the column names, e.g.
+#   SummedDet < 3500 and NReadoutHits < 70 and abs(RecoilD0) < 10 and not Fiducial
+# with and / or / not, comparisons, + - * / ** and abs, sqrt, log, exp. It is
+# parsed into a whitelisted tree, nothing is ever eval-ed. The answer is one
+# JSON line with the passing events, their summed Weight and the total.
+#
+# How to run example:
+# python3 cutQueryDaemon.py serve --ingest /tmp/cutq_ingest.sock --query /tmp/cutq.sock --load pn_features_*.bin
+# python3 cutQueryDaemon.py query --query /tmp/cutq.sock "SummedDet < 3500 and HcalVeto"
+import argparse
+import ast
+import json
+import itertools
+import os
+import signal
+import socket
+import socketserver
+import struct
+import sys
+import threading
+import time
+from concurrent.futures import ThreadPoolExecutor
+
+import numpy
+
+
+def readExactly(stream, n):
+    data = b""
+    while len(data) < n:
+        more = stream.read(n - len(data))
+        if not more:
+            return None
+        data += more
+    return data
+
+
+def readChunks(stream):
+    # Column names, then one (number of events, [column arrays]) per chunk
+    words = stream.readline().split()
+    if len(words) != 3 or words[0] != b"FEATURES" or words[1] != b"1":
+        raise ValueError("not a feature stream")
+    names = stream.readline().decode().split()
+    if len(names) != int(words[2]):
+        raise ValueError("feature stream header lists %d of %s columns" % (len(names), words[2].decode()))
+    yield names
+    while True:
+        header = readExactly(stream, 4)
+        if header is None:
+            return
+        n = struct.unpack("<I", header)[0]
+        data = readExactly(stream, 4 * n * len(names))
+        if data is None:
+            return
+        yield n, numpy.frombuffer(data, dtype="<f4").reshape(len(names), n)
+
+
+class Constant:
+    def __init__(self, value):
+        self.value = value
+        self.nbytes = 4
+
+
+def encode(values):
+    # Narrowest exact representation of a float32 column
+    if len(values) and (values == values[0]).all():
+        return Constant(numpy.float32(values[0]))
+    if numpy.isfinite(values).all() and (values == numpy.round(values)).all():
+        for dtype in (numpy.int8, numpy.int16, numpy.int32):
+            info = numpy.iinfo(dtype)
+            if values.min() >= info.min and values.max() <= info.max:
+                return values.astype(dtype)
+    return values.copy()
+
+
+class Block:
+    def __init__(self, names, columns):
+        self.n = columns.shape[1]
+        self.columns = {name: encode(column) for name, column in zip(names, columns)}
+        self.nbytes = sum(c.nbytes for c in self.columns.values())
+
+    def column(self, name):
+        c = self.columns[name]
+        return c.value if isinstance(c, Constant) else c
+
+
+class ColumnStore:
+    def __init__(self, blockEvents):
+        self.blockEvents = blockEvents
+        self.names = None
+        self.blocks = []
+        self.lock = threading.Lock()
+
+    def ingest(self, stream, label):
+        chunks = readChunks(stream)
+        names = next(chunks)
+        with self.lock:
+            if self.names is None:
+                self.names = names
+            elif names != self.names:
+                print("[ cutQueryDaemon ]: %s has different columns, ignored" % label)
+                return 0
+        pending, nPending, nEvents = [], 0, 0
+        for n, columns in chunks:
+            pending.append(columns)
+            nPending += n
+            if nPending >= self.blockEvents:
+                nEvents += self.addBlock(pending)
+                pending, nPending = [], 0
+        if pending:
+            nEvents += self.addBlock(pending)
+        print("[ cutQueryDaemon ]: %d events from %s" % (nEvents, label))
+        return nEvents
+
+    def addBlock(self, chunks):
+        block = Block(self.names, numpy.concatenate(chunks, axis=1))
+        with self.lock:
+            self.blocks.append(block)
+        return block.n
+
+    def snapshot(self):
+        with self.lock:
+            return list(self.blocks)
+
+
+class QueryError(Exception):
+    pass
+
+
+FUNCTIONS = {"abs": numpy.abs, "sqrt": numpy.sqrt, "log": numpy.log, "exp": numpy.exp}
+COMPARISONS = {ast.Lt: numpy.less, ast.LtE: numpy.less_equal, ast.Gt: numpy.greater,
+               ast.GtE: numpy.greater_equal, ast.Eq: numpy.equal, ast.NotEq: numpy.not_equal}
+ARITHMETIC = {ast.Add: numpy.add, ast.Sub: numpy.subtract, ast.Mult: numpy.multiply,
+              ast.Div: numpy.true_divide, ast.Pow: numpy.power}
+
+
+def compileQuery(expression, names):
+    # Whitelisted expression tree -> function of a Block returning values or a mask
+    try:
+        tree = ast.parse(expression, mode="eval").body
+    except SyntaxError as e:
+        raise QueryError("syntax error: %s" % e.msg)
+
+    def number(f):
+        # Integer columns are narrow, do arithmetic in float64
+        return lambda b: numpy.asarray(f(b), dtype=numpy.float64)
+
+    def build(node):
+        if isinstance(node, ast.BoolOp):
+            parts = [build(v) for v in node.values]
+            op = numpy.logical_and if isinstance(node.op, ast.And) else numpy.logical_or
+
+            def boolOp(b):
+                result = parts[0](b)
+                for part in parts[1:]:
+                    result = op(result, part(b))
+                return result
+            return boolOp
+        if isinstance(node, ast.UnaryOp):
+            operand = build(node.operand)
+            if isinstance(node.op, (ast.Not, ast.Invert)):
+                return lambda b: numpy.logical_not(operand(b))
+            if isinstance(node.op, ast.USub):
+                operand = number(operand)
+                return lambda b: -operand(b)
+            if isinstance(node.op, ast.UAdd):
+                return operand
+        if isinstance(node, ast.BinOp):
+            if isinstance(node.op, (ast.BitAnd, ast.BitOr)):
+                left, right = build(node.left), build(node.right)
+                op = numpy.logical_and if isinstance(node.op, ast.BitAnd) else numpy.logical_or
+                return lambda b: op(left(b), right(b))
+            if type(node.op) in ARITHMETIC:
+                left, right = number(build(node.left)), number(build(node.right))
+                op = ARITHMETIC[type(node.op)]
+                return lambda b: op(left(b), right(b))
+        if isinstance(node, ast.Compare):
+            operands = [build(node.left)] + [build(c) for c in node.comparators]
+            ops = []
+            for op in node.ops:
+                if type(op) not in COMPARISONS:
+                    raise QueryError("unsupported comparison %s" % type(op).__name__)
+                ops.append(COMPARISONS[type(op)])
+
+            def compare(b):
+                values = [o(b) for o in operands]
+                result = ops[0](values[0], values[1])
+                for i in range(1, len(ops)):
+                    result = numpy.logical_and(result, ops[i](values[i], values[i + 1]))
+                return result
+            return compare
+        if isinstance(node, ast.Call):
+            if not isinstance(node.func, ast.Name) or node.func.id not in FUNCTIONS or len(node.args) != 1 or node.keywords:
+                raise QueryError("only %s of one argument are allowed" % ", ".join(FUNCTIONS))
+            function, argument = FUNCTIONS[node.func.id], number(build(node.args[0]))
+            return lambda b: function(argument(b))
+        if isinstance(node, ast.Name):
+            if node.id not in names:
+                raise QueryError("unknown column %s" % node.id)
+            name = node.id
+            return lambda b: b.column(name)
+        if isinstance(node, ast.Constant) and isinstance(node.value, (bool, int, float)):
+            value = node.value
+            return lambda b: value
+        raise QueryError("not allowed in a query: %s" % ast.dump(node)[:60])
+
+    return build(tree)
+
+
+def scan(store, pool, expression):
+    blocks = store.snapshot()
+    if not blocks:
+        return {"passed": 0, "weighted": 0., "total": 0}
+    selection = compileQuery(expression, store.names)
+    hasWeight = "Weight" in store.names
+
+    def count(block):
+        mask = numpy.broadcast_to(numpy.asarray(selection(block), dtype=bool), (block.n,))
+        passed = int(numpy.count_nonzero(mask))
+        if not hasWeight:
+            return passed, float(passed)
+        weights = numpy.broadcast_to(block.column("Weight"), (block.n,))
+        return passed, float(weights[mask].sum(dtype=numpy.float64))
+
+    results = list(pool.map(count, blocks))
+    return {"passed": sum(r[0] for r in results), "weighted": sum(r[1] for r in results),
+            "total": sum(b.n for b in blocks)}
+
+
+def unixServer(path, handler):
+    if os.path.exists(path):
+        os.remove(path)
+    server = socketserver.ThreadingUnixStreamServer(path, handler)
+    server.daemon_threads = True
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    return server
+
+
+def serve(args):
+    store = ColumnStore(args.blockEvents)
+    pool = ThreadPoolExecutor(args.threads)
+    streams = itertools.count(1)
+
+    class IngestHandler(socketserver.StreamRequestHandler):
+        def handle(self):
+            try:
+                store.ingest(self.rfile, "stream %d" % next(streams))
+            except ValueError as e:
+                print("[ cutQueryDaemon ]: bad stream: %s" % e)
+
+    class QueryHandler(socketserver.StreamRequestHandler):
+        def handle(self):
+            for line in self.rfile:
+                request = line.decode().strip()
+                if not request:
+                    continue
+                start = time.time()
+                try:
+                    if request == "COLUMNS":
+                        blocks = store.snapshot()
+                        reply = {"columns": store.names or [], "events": sum(b.n for b in blocks),
+                                 "blocks": len(blocks), "bytes": sum(b.nbytes for b in blocks)}
+                    else:
+                        if request.startswith("COUNT "):
+                            request = request[6:]
+                        reply = scan(store, pool, request)
+                except QueryError as e:
+                    reply = {"error": str(e)}
+                except Exception as e:
+                    reply = {"error": "%s: %s" % (type(e).__name__, e)}
+                reply["ms"] = round(1000. * (time.time() - start), 3)
+                self.wfile.write((json.dumps(reply) + "\n").encode())
+
+    if args.ingest:
+        unixServer(args.ingest, IngestHandler)
+    for path in args.load:
+        with open(path, "rb") as f:
+            store.ingest(f, path)
+    unixServer(args.query, QueryHandler)
+    print("[ cutQueryDaemon ]: answering queries on " + args.query)
+    # Clean up the sockets on kill as well
+    signal.signal(signal.SIGTERM, lambda *_: sys.exit(0))
+    try:
+        while True:
+            time.sleep(3600)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        for path in [args.ingest, args.query]:
+            if path and os.path.exists(path):
+                os.remove(path)
+
+
+def query(args):
+    connection = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    connection.connect(args.query)
+    replies = connection.makefile("rb")
+    expressions = args.expressions or (line.strip() for line in sys.stdin)
+    for expression in expressions:
+        if not expression:
+            continue
+        connection.sendall((expression + "\n").encode())
+        print(replies.readline().decode().strip())
+
+
+def main():
+    parser = argparse.ArgumentParser(description='')
+    commands = parser.add_subparsers(dest='command', required=True)
+    serveParser = commands.add_parser('serve')
+    serveParser.add_argument('--ingest', action='store', dest='ingest', default='',
+                             help='Unix socket the analyzers stream to')
+    serveParser.add_argument('--query', action='store', dest='query', required=True, help='Unix socket for queries')
+    serveParser.add_argument('--load', action='store', dest='load', nargs='+', default=[], help='feature stream files')
+    serveParser.add_argument('-j', '--threads', action='store', dest='threads', type=int, default=os.cpu_count())
+    serveParser.add_argument('--block-events', action='store', dest='blockEvents', type=int, default=1 << 16)
+    queryParser = commands.add_parser('query')
+    queryParser.add_argument('--query', action='store', dest='query', required=True)
+    queryParser.add_argument('expressions', nargs='*', help='one per query, or lines from stdin; COLUMNS lists the columns')
+    args = parser.parse_args()
+    if args.command == 'serve':
+        serve(args)
+    else:
+        query(args)
+
+
+if __name__ == "__main__" :
+    main()
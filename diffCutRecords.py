@@ -0,0 +1,166 @@
+#!/usr/bin/env python
+# Event by event comparison of the cut outcomes of two analyzer versions, from
+# the cut record files CutBasedDM writes with cut_record_file. Each side can
+# be several files (e.g. one per job). The records are sorted by (run, event),
+# so the key range is split in partitions that worker processes join
+# independently; a worker only reads the slice of every file in its range,
+# which keeps the memory bounded by the partition size rather than the inputs.
+#
+# For every variant and cut flow it reports the events passing the full flow
+# in A and B and how many were gained / lost, for every cut how many events
+# flipped, and lists the first flipped events.
+#
+# How to run example:
+# python3 diffCutRecords.py -a v17/records_*.bin -b v18/records_*.bin -j 8 -n 20
+import argparse
+import multiprocessing
+
+import numpy
+
+
+class RecordFile:
+    def __init__(self, path):
+        self.path = path
+        self.flows = {}
+        with open(path, "rb") as f:
+            if f.readline().split() != [b"CUTRECORD", b"1"]:
+                raise ValueError(path + " is not a cut record file")
+            while True:
+                words = f.readline().decode().split()
+                if words[0] == "cuts":
+                    self.cuts = words[1:]
+                elif words[0] == "flow":
+                    self.flows[words[1]] = words[2:]
+                elif words[0] == "variants":
+                    self.variants = words[1:]
+                elif words[0] == "records":
+                    self.nRecords = int(words[1])
+                    self.offset = f.tell()
+                    break
+        self.dtype = numpy.dtype([("key", "<u8"), ("masks", "<u4", (len(self.variants),))])
+
+    def records(self):
+        if self.nRecords == 0:
+            return numpy.zeros(0, dtype=self.dtype)
+        return numpy.memmap(self.path, dtype=self.dtype, mode="r", offset=self.offset, shape=(self.nRecords,))
+
+    def bit(self, cut):
+        return numpy.uint32(1 << self.cuts.index(cut))
+
+
+def loadRange(files, lo, hi, variants):
+    # Records with lo <= key < hi (no upper limit for None), masks reordered
+    # to the common variants
+    keys, masks = [], []
+    for f in files:
+        records = f.records()
+        begin = numpy.searchsorted(records["key"], numpy.uint64(lo))
+        end = len(records) if hi is None else numpy.searchsorted(records["key"], numpy.uint64(hi))
+        chunk = numpy.array(records[begin:end])
+        keys.append(chunk["key"])
+        masks.append(chunk["masks"][:, [f.variants.index(v) for v in variants]])
+    keys = numpy.concatenate(keys)
+    masks = numpy.concatenate(masks)
+    order = numpy.argsort(keys, kind="stable")
+    return keys[order], masks[order]
+
+
+def joinPartition(task):
+    filesA, filesB, lo, hi, variants, cuts, flowsA, flowsB, nExamples = task
+    keysA, masksA = loadRange(filesA, lo, hi, variants)
+    keysB, masksB = loadRange(filesB, lo, hi, variants)
+    common, iA, iB = numpy.intersect1d(keysA, keysB, assume_unique=False, return_indices=True)
+    result = {"onlyA": len(keysA) - len(common), "onlyB": len(keysB) - len(common), "common": len(common),
+              "flips": {}, "flows": {}, "examples": []}
+    bitsA = [filesA[0].bit(c) for c in cuts]
+    bitsB = [filesB[0].bit(c) for c in cuts]
+    for v in range(len(variants)):
+        mA, mB = masksA[iA, v], masksB[iB, v]
+        flipped = numpy.zeros(len(common), dtype=bool)
+        for c, cut in enumerate(cuts):
+            changed = ((mA & bitsA[c]) != 0) != ((mB & bitsB[c]) != 0)
+            result["flips"][(v, cut)] = int(changed.sum())
+            flipped |= changed
+        for flow in flowsA:
+            flowA = numpy.uint32(sum(1 << filesA[0].cuts.index(c) for c in flowsA[flow]))
+            flowB = numpy.uint32(sum(1 << filesB[0].cuts.index(c) for c in flowsB[flow]))
+            passA = (mA & flowA) == flowA
+            passB = (mB & flowB) == flowB
+            result["flows"][(v, flow)] = (int(passA.sum()), int(passB.sum()), int((passB & ~passA).sum()),
+                                          int((passA & ~passB).sum()))
+        for i in numpy.nonzero(flipped)[0][:nExamples]:
+            changed = [cut for c, cut in enumerate(cuts) if bool(mA[i] & bitsA[c]) != bool(mB[i] & bitsB[c])]
+            result["examples"].append((int(common[i]), variants[v], changed))
+    return result
+
+
+def partitionBounds(files, nPartitions):
+    # Key quantiles of a sample of all records
+    sample = numpy.concatenate([f.records()["key"][::max(1, f.nRecords // 10000)] for f in files])
+    if len(sample) == 0:
+        return [0, None]
+    bounds = numpy.unique(numpy.quantile(sample, numpy.linspace(0, 1, nPartitions + 1)[1:-1]).astype(numpy.uint64))
+    return [0] + [int(b) for b in bounds if b > 0] + [None]
+
+
+def main():
+    parser = argparse.ArgumentParser(description='')
+    parser.add_argument('-a', action='store', dest='a', nargs='+', required=True, help='cut record files of version A')
+    parser.add_argument('-b', action='store', dest='b', nargs='+', required=True, help='cut record files of version B')
+    parser.add_argument('-j', '--jobs', action='store', dest='jobs', type=int, default=multiprocessing.cpu_count())
+    parser.add_argument('-p', '--partitions', action='store', dest='partitions', type=int, default=0,
+                        help='key range partitions, 4 per job by default')
+    parser.add_argument('-n', '--examples', action='store', dest='examples', type=int, default=10,
+                        help='flipped events to list')
+    args = parser.parse_args()
+
+    filesA = [RecordFile(path) for path in args.a]
+    filesB = [RecordFile(path) for path in args.b]
+    variants = [v for v in filesA[0].variants if all(v in f.variants for f in filesA + filesB)]
+    cuts = [c for c in filesA[0].cuts if all(c in f.cuts for f in filesA + filesB)]
+    for name in set(filesA[0].cuts + filesB[0].cuts) - set(cuts):
+        print("Cut %s only in one of the versions, not compared" % name)
+    # A flow can be defined differently in the two versions, each side is
+    # evaluated with its own definition
+    flowsA, flowsB = {}, {}
+    for name, flowCuts in filesA[0].flows.items():
+        if name in filesB[0].flows and all(c in cuts for c in flowCuts + filesB[0].flows[name]):
+            flowsA[name], flowsB[name] = flowCuts, filesB[0].flows[name]
+            if flowsA[name] != flowsB[name]:
+                print("Flow %s differs: A %s, B %s" % (name, " ".join(flowsA[name]), " ".join(flowsB[name])))
+
+    bounds = partitionBounds(filesA + filesB, args.partitions or 4 * args.jobs)
+    tasks = [(filesA, filesB, bounds[i], bounds[i + 1], variants, cuts, flowsA, flowsB, args.examples)
+             for i in range(len(bounds) - 1)]
+    with multiprocessing.Pool(args.jobs) as pool:
+        results = pool.map(joinPartition, tasks)
+
+    total = {"onlyA": 0, "onlyB": 0, "common": 0}
+    flips, flowCounts, examples = {}, {}, []
+    for r in results:
+        for k in total:
+            total[k] += r[k]
+        for k, n in r["flips"].items():
+            flips[k] = flips.get(k, 0) + n
+        for k, counts in r["flows"].items():
+            flowCounts[k] = [x + y for x, y in zip(flowCounts.get(k, [0, 0, 0, 0]), counts)]
+        examples += r["examples"]
+
+    print("Events in both: %d, only in A: %d, only in B: %d" % (total["common"], total["onlyA"], total["onlyB"]))
+    for v, variant in enumerate(variants):
+        print("\nVariant %s" % variant)
+        print("  %-20s %10s %10s %10s %10s" % ("flow", "pass A", "pass B", "gained", "lost"))
+        for flow in flowsA:
+            print("  %-20s %10d %10d %10d %10d" % ((flow,) + tuple(flowCounts[(v, flow)])))
+        print("  %-20s %10s" % ("cut", "flipped"))
+        for cut in cuts:
+            if flips[(v, cut)]:
+                print("  %-20s %10d" % (cut, flips[(v, cut)]))
+    if examples:
+        print("\nFlipped events (run, event, variant: cuts)")
+        for key, variant, changed in sorted(examples)[:args.examples]:
+            print("  %d %d %s: %s" % (key >> 32, key & 0xffffffff, variant, " ".join(changed)))
+
+
+if __name__ == "__main__" :
+    main()
@@ -5,6 +5,8 @@ directory = sys.argv[1]
 
 i = 0
 j = 1
+# hadd merges every histogram found in any of the files, so the ones booked
+# only by some jobs need no special treatment
 command = "hadd mc_v14-8gev-8.0GeV-1e-ecal_photonuclear_run1.root"
 # Loop through each file in the directory
 os.chdir(directory)
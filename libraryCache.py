@@ -0,0 +1,169 @@
+# Shared cache of the compiled analyzer libraries for the cfg files.
+#
+# ldmxcfg's from_file() compiles lib<Name>.so next to the source whenever the
+# source is newer than the library, i.e. in every fresh job. cachedFromFile()
+# copies the source (and the local headers it includes) to
+#   <cache dir>/<Name>-<key>/
+# where key hashes the sources, the compiler version, CXXFLAGS and the
+# framework installation, and calls from_file() on that copy. The first job
+# to get the lock compiles, concurrent jobs wait for it and then load the
+# same library, later jobs find it ready.
+#
+# The cache dir is CUTBASED_LIB_CACHE, ~/.cache/cutbased by default; point
+# it to a shared file system for batch jobs. A stale lock (crashed job) is
+# taken over after CUTBASED_LIB_CACHE_LOCK_TIMEOUT seconds (default 900);
+# the compiling job touches its lock meanwhile, so a long compile keeps it.
+#
+# How to use, in a cfg:
+# from libraryCache import cachedFromFile
+# cutBasedAna = cachedFromFile(ldmxcfg.Analyzer, 'CutBasedDM.cxx')
+import hashlib
+import os
+import random
+import re
+import shutil
+import socket
+import subprocess
+import threading
+import time
+
+
+def localSources(sourceFile):
+    # The source and every quoted include found next to it, recursively
+    sources = []
+    pending = [os.path.abspath(sourceFile)]
+    while pending:
+        path = pending.pop()
+        if path in sources:
+            continue
+        sources.append(path)
+        with open(path, "r") as f:
+            for include in re.findall(r'^\s*#include\s+"([^"]+)"', f.read(), re.MULTILINE):
+                candidate = os.path.join(os.path.dirname(path), include)
+                if os.path.isfile(candidate):
+                    pending.append(os.path.abspath(candidate))
+    return sources
+
+
+def cacheKey(sources):
+    key = hashlib.sha256()
+    for path in sorted(sources):
+        key.update(os.path.basename(path).encode())
+        with open(path, "rb") as f:
+            key.update(f.read())
+    try:
+        compiler = subprocess.run([os.environ.get("CXX", "g++"), "--version"], capture_output=True, text=True).stdout
+    except OSError:
+        compiler = "unknown"
+    key.update(compiler.encode())
+    key.update(os.environ.get("CXXFLAGS", "").encode())
+    # Framework build: where ldmxcfg lives and when it was installed
+    from LDMX.Framework import ldmxcfg
+    key.update(os.path.realpath(ldmxcfg.__file__).encode())
+    key.update(str(os.path.getmtime(ldmxcfg.__file__)).encode())
+    for var in ["LDMX_SW_INSTALL", "LDMX_DOCKER_TAG", "APPTAINER_NAME", "SINGULARITY_NAME"]:
+        key.update(os.environ.get(var, "").encode())
+    return key.hexdigest()[:16]
+
+
+def readLock(lockFile):
+    try:
+        with open(lockFile, "r") as f:
+            return f.read()
+    except FileNotFoundError:
+        return None
+
+
+def acquireLock(lockFile, timeout):
+    # The token written into the lock when we got it, None if someone else has it
+    while True:
+        token = "%s %d %f\n" % (socket.gethostname(), os.getpid(), time.time())
+        try:
+            fd = os.open(lockFile, os.O_CREAT | os.O_EXCL | os.O_WRONLY)
+            os.write(fd, token.encode())
+            os.close(fd)
+            return token
+        except FileExistsError:
+            pass
+        try:
+            if time.time() - os.path.getmtime(lockFile) <= timeout:
+                return None
+            stale = readLock(lockFile)
+            # Take over by renaming it away: only one waiter gets the rename
+            moved = "%s.stale.%s.%d.%d" % (lockFile, socket.gethostname(), os.getpid(), random.getrandbits(32))
+            os.rename(lockFile, moved)
+        except FileNotFoundError:
+            continue
+        if readLock(moved) != stale or time.time() - os.path.getmtime(moved) <= timeout:
+            # Renamed a lock that was just taken, put it back unless taken again
+            try:
+                os.link(moved, lockFile)
+            except FileExistsError:
+                pass
+            os.remove(moved)
+            return None
+        print("[ libraryCache ]: taking over stale lock " + lockFile)
+        os.remove(moved)
+
+
+def releaseLock(lockFile, token):
+    # Only our own lock, it may have been taken over meanwhile
+    try:
+        if readLock(lockFile) == token:
+            os.remove(lockFile)
+    except FileNotFoundError:
+        pass
+
+
+def keepLockFresh(lockFile, token, period, done):
+    # Touch the lock while compiling, so that it is not taken for stale
+    while not done.wait(period):
+        try:
+            if readLock(lockFile) != token:
+                return
+            os.utime(lockFile)
+        except FileNotFoundError:
+            return
+
+
+def cachedFromFile(processorClass, sourceFile, *args, **kwargs):
+    cacheDir = os.path.expanduser(os.environ.get("CUTBASED_LIB_CACHE", "~/.cache/cutbased"))
+    timeout = float(os.environ.get("CUTBASED_LIB_CACHE_LOCK_TIMEOUT", "900"))
+    sources = localSources(sourceFile)
+    name = os.path.splitext(os.path.basename(sourceFile))[0]
+    entry = os.path.join(cacheDir, name + "-" + cacheKey(sources))
+    readyFile = os.path.join(entry, "READY")
+    lockFile = entry + ".lock"
+    cachedSource = os.path.join(entry, os.path.basename(sourceFile))
+
+    try:
+        os.makedirs(cacheDir, exist_ok=True)
+    except OSError as e:
+        print("[ libraryCache ]: cannot use %s (%s), compiling in place" % (cacheDir, e))
+        return processorClass.from_file(sourceFile, *args, **kwargs)
+
+    while not os.path.exists(readyFile):
+        token = acquireLock(lockFile, timeout)
+        if token is None:
+            # Someone else is compiling this key
+            time.sleep(2. + 3. * random.random())
+            continue
+        done = threading.Event()
+        threading.Thread(target=keepLockFresh, args=(lockFile, token, max(1., timeout / 4.), done), daemon=True).start()
+        try:
+            if not os.path.exists(readyFile):
+                # Fresh copy of the sources, compiled by from_file() below
+                shutil.rmtree(entry, ignore_errors=True)
+                os.makedirs(entry)
+                for path in sources:
+                    shutil.copy(path, entry)
+                print("[ libraryCache ]: compiling %s into %s" % (sourceFile, entry))
+                processor = processorClass.from_file(cachedSource, *args, **kwargs)
+                open(readyFile, "w").close()
+                return processor
+        finally:
+            done.set()
+            releaseLock(lockFile, token)
+
+    print("[ libraryCache ]: using cached library in " + entry)
+    return processorClass.from_file(cachedSource, *args, **kwargs)
@@ -0,0 +1,211 @@
+#!/usr/bin/env python
+# Output-equivalence and throughput regression check for CutBasedDM
+#
+# Runs cfg_ana_cutBasedDM.py over a small, fixed set of input files, then
+#  - compares every histogram of the output bin-for-bin (contents, errors,
+#    labels) against the golden histogram file
+#  - compares events/sec of the event loop (from the analyzer's metrics file,
+#    so cfg parsing and compiling the library are not included) and peak RSS
+#    against the stored baseline
+# and exits non-zero on any output difference or a throughput/memory
+# regression beyond the tolerance.
+#
+# How to run example:
+# python3 regressionCheck.py -i regression/inputs.txt
+# The inputs list, golden histograms and baseline are per site, not in the
+# repository: write the list, then (re)create the golden histograms and baseline after an intended change:
+# python3 regressionCheck.py -i regression/inputs.txt --update
+# The batched mode has to give the same histograms:
+# python3 regressionCheck.py -i regression/inputs.txt --batch-size 1024
+import argparse
+import json
+import logging
+import os
+import resource
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+import ROOT
+
+ROOT.gROOT.SetBatch(True)
+
+
+def collectHistos(directory, prefix=""):
+    # All histograms below directory, keyed by their path in the file
+    histos = {}
+    for key in directory.GetListOfKeys():
+        obj = key.ReadObj()
+        path = prefix + key.GetName()
+        if obj.InheritsFrom("TDirectory"):
+            histos.update(collectHistos(obj, path + "/"))
+        elif obj.InheritsFrom("TH1"):
+            obj.SetDirectory(0)
+            histos[path] = obj
+    return histos
+
+
+def axisLabels(axis):
+    return [axis.GetBinLabel(i) for i in range(1, axis.GetNbins() + 1)]
+
+
+def compareHisto(name, new, ref):
+    # Bin-for-bin comparison including under- and overflow, returns a list of differences
+    diffs = []
+    if new.ClassName() != ref.ClassName():
+        return [name + ": class " + new.ClassName() + " != " + ref.ClassName()]
+    for axisName in ["GetXaxis", "GetYaxis", "GetZaxis"]:
+        newAxis = getattr(new, axisName)()
+        refAxis = getattr(ref, axisName)()
+        if (newAxis.GetNbins(), newAxis.GetXmin(), newAxis.GetXmax()) != (refAxis.GetNbins(), refAxis.GetXmin(), refAxis.GetXmax()):
+            return [name + ": binning of " + axisName[3] + " axis changed"]
+        if axisLabels(newAxis) != axisLabels(refAxis):
+            diffs.append(name + ": bin labels of " + axisName[3] + " axis changed")
+    if new.GetEntries() != ref.GetEntries():
+        diffs.append(name + ": entries " + str(new.GetEntries()) + " != " + str(ref.GetEntries()))
+    nCells = new.GetNcells()
+    nDiff = 0
+    for i in range(nCells):
+        if new.GetBinContent(i) != ref.GetBinContent(i) or new.GetBinError(i) != ref.GetBinError(i):
+            if nDiff < 5:
+                diffs.append(name + ": bin " + str(i) + " " + str(new.GetBinContent(i)) + " != " + str(ref.GetBinContent(i)))
+            nDiff += 1
+    if nDiff > 5:
+        diffs.append(name + ": ... " + str(nDiff) + " bins differ in total")
+    return diffs
+
+
+def compareFiles(newFileName, refFileName):
+    newFile = ROOT.TFile.Open(newFileName)
+    refFile = ROOT.TFile.Open(refFileName)
+    newHistos = collectHistos(newFile)
+    refHistos = collectHistos(refFile)
+    diffs = []
+    for name in sorted(set(refHistos) - set(newHistos)):
+        diffs.append(name + ": missing from the output")
+    for name in sorted(set(newHistos) - set(refHistos)):
+        diffs.append(name + ": not in the golden file")
+    for name in sorted(set(newHistos) & set(refHistos)):
+        diffs.extend(compareHisto(name, newHistos[name], refHistos[name]))
+    return diffs, len(refHistos)
+
+
+def countEvents(fileName):
+    # TrigEffVsMissingE is filled exactly once per processed event
+    histos = collectHistos(ROOT.TFile.Open(fileName))
+    for name, histo in histos.items():
+        if name.endswith("TrigEffVsMissingE"):
+            return histo.GetEntries()
+    return 0
+
+
+def readMetrics(fileName):
+    # Unlabelled samples of the Prometheus text file written by CutBasedDM
+    metrics = {}
+    with open(fileName, "r") as f:
+        for line in f:
+            words = line.split()
+            if len(words) == 2 and not line.startswith("#") and "{" not in words[0]:
+                metrics[words[0]] = float(words[1])
+    return metrics
+
+
+def main():
+    parser = argparse.ArgumentParser(description='')
+    parser.add_argument('-i', '--inputs', action='store', dest='inputs', required=True,
+                        help='text file with one input ROOT file per line')
+    parser.add_argument('-c', '--cfg', action='store', dest='cfg', default='cfg_ana_cutBasedDM.py')
+    parser.add_argument('-g', '--golden', action='store', dest='golden', default='regression/golden_histo.root')
+    parser.add_argument('-b', '--baseline', action='store', dest='baseline', default='regression/baseline.json')
+    parser.add_argument('-t', '--tolerance', action='store', dest='tolerance', type=float, default=0.15,
+                        help='allowed relative throughput loss / peak RSS growth')
+    parser.add_argument('--fire', action='store', dest='fire', default='fire')
+    parser.add_argument('--batch-size', action='store', dest='batch_size', type=int, default=0,
+                        help='run CutBasedDM in batched mode with this block size')
+    parser.add_argument('--update', action='store_true', dest='update')
+    args = parser.parse_args()
+
+    logging.basicConfig(format='[ regressionCheck ][ %(levelname)s ]: %(message)s', level=logging.INFO)
+
+    missing = [path for path in [args.inputs] if not os.path.isfile(path)]
+    if not args.update:
+        missing += [path for path in [args.golden, args.baseline] if not os.path.isfile(path)]
+    if missing:
+        logging.error('Missing %s; the inputs list (one ROOT file per line) is written by hand, '
+                      'the golden histograms and baseline by a run with --update' % ', '.join(missing))
+        sys.exit(2)
+
+    with open(args.inputs, "r") as a_file:
+        inputFiles = [line.strip() for line in a_file if line.strip() and not line.startswith("#")]
+
+    workDir = tempfile.mkdtemp(prefix="cutbased_regression_")
+    outFile = os.path.join(workDir, "regression_histo.root")
+    metricsFile = os.path.join(workDir, "regression_metrics.prom")
+    env = dict(os.environ)
+    env["CUTBASED_HISTO_FILE"] = outFile
+    env["CUTBASED_BATCH_SIZE"] = str(args.batch_size)
+    env["CUTBASED_METRICS_FILE"] = metricsFile
+
+    command = [args.fire, args.cfg] + inputFiles
+    logging.info('Running: %s' % ' '.join(command))
+    start = time.perf_counter()
+    result = subprocess.run(command, env=env)
+    wallTime = time.perf_counter() - start
+    # ru_maxrss is in kB on Linux
+    peakRSS = resource.getrusage(resource.RUSAGE_CHILDREN).ru_maxrss / 1024.
+    if result.returncode != 0:
+        logging.error('fire exited with %d' % result.returncode)
+        sys.exit(1)
+
+    nEvents = countEvents(outFile)
+    # Event loop only, fire's start-up and a cold library cache vary from run to run
+    if os.path.isfile(metricsFile):
+        loopTime = readMetrics(metricsFile).get("cutbased_uptime_seconds", wallTime)
+    else:
+        logging.warning('No metrics file from %s, timing the whole fire run' % args.cfg)
+        loopTime = wallTime
+    rate = nEvents / loopTime if loopTime > 0 else 0.
+    logging.info('%d events in %.1f s (%.1f s in fire): %.2f events/s, peak RSS %.1f MB'
+                 % (nEvents, loopTime, wallTime, rate, peakRSS))
+
+    if args.update:
+        os.makedirs(os.path.dirname(os.path.abspath(args.golden)), exist_ok=True)
+        shutil.copy(outFile, args.golden)
+        with open(args.baseline, "w") as f:
+            json.dump({"events": nEvents, "events_per_sec": rate, "peak_rss_mb": peakRSS}, f, indent=2)
+        logging.info('Updated %s and %s' % (args.golden, args.baseline))
+        shutil.rmtree(workDir)
+        return
+
+    failed = False
+    diffs, nHistos = compareFiles(outFile, args.golden)
+    for diff in diffs:
+        logging.error(diff)
+    if diffs:
+        failed = True
+    else:
+        logging.info('All %d histograms identical to %s' % (nHistos, args.golden))
+
+    with open(args.baseline, "r") as f:
+        baseline = json.load(f)
+    if nEvents != baseline["events"]:
+        logging.error('Processed %d events, baseline has %d' % (nEvents, baseline["events"]))
+        failed = True
+    if rate < baseline["events_per_sec"] * (1. - args.tolerance):
+        logging.error('Throughput %.2f events/s is below the baseline %.2f events/s' % (rate, baseline["events_per_sec"]))
+        failed = True
+    if peakRSS > baseline["peak_rss_mb"] * (1. + args.tolerance):
+        logging.error('Peak RSS %.1f MB is above the baseline %.1f MB' % (peakRSS, baseline["peak_rss_mb"]))
+        failed = True
+
+    if failed:
+        logging.error('Output kept in %s' % workDir)
+        sys.exit(1)
+    shutil.rmtree(workDir)
+    logging.info('Regression check passed')
+
+
+if __name__ == "__main__" :
+    main()
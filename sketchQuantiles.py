@@ -0,0 +1,93 @@
+#!/usr/bin/env python
+# Print quantiles from the Quantile_<variable>_CnC<stage> sketches written by
+# CutBasedDM (see QuantileSketch.h). Works on single job outputs as well as
+# on hadd-ed files, the sketches merge exactly.
+#
+# How to run example:
+# python3 sketchQuantiles.py signal_histo.root -q 0.5 0.99 0.999 -v SummedTightIso -s 2 12
+import argparse
+import math
+import re
+
+import ROOT
+
+ROOT.gROOT.SetBatch(True)
+
+
+class SketchLayout:
+    # Python twin of QuantileSketchLayout, rebuilt from the histogram title
+    def __init__(self, title):
+        params = dict(re.findall(r'(\w+)=([-+.\deE]+)', title))
+        alpha = float(params["alpha"])
+        self.gamma = (1. + alpha) / (1. - alpha)
+        logGamma = math.log(self.gamma)
+        self.kMin = int(math.ceil(math.log(float(params["min"])) / logGamma))
+        self.nPerSign = int(math.ceil(math.log(float(params["max"])) / logGamma)) - self.kMin + 1
+
+    def value(self, idx):
+        if idx == self.nPerSign:
+            return 0.
+        offset = idx - self.nPerSign - 1 if idx > self.nPerSign else self.nPerSign - 1 - idx
+        v = 2. * self.gamma ** (self.kMin + offset) / (self.gamma + 1.)
+        return v if idx > self.nPerSign else -v
+
+
+def quantiles(sketch, qs):
+    layout = SketchLayout(sketch.GetTitle())
+    # Bucket idx is histogram bin idx+1, bin 0 / N+1 hold values beyond -max / +max
+    counts = [sketch.GetBinContent(b) for b in range(0, sketch.GetNbinsX() + 2)]
+    total = sum(counts)
+    result = []
+    for q in qs:
+        rank = q * (total - 1)
+        cumulative = 0.
+        for b, count in enumerate(counts):
+            cumulative += count
+            if cumulative > rank:
+                break
+        if b == 0:
+            result.append(float("-inf"))
+        elif b == len(counts) - 1:
+            result.append(float("inf"))
+        else:
+            result.append(layout.value(b - 1))
+    return total, result
+
+
+def collectSketches(directory, sketches):
+    for key in directory.GetListOfKeys():
+        obj = key.ReadObj()
+        if obj.InheritsFrom("TDirectory"):
+            collectSketches(obj, sketches)
+        elif key.GetName().startswith("Quantile_") or "_Quantile_" in key.GetName():
+            sketches.append((directory.GetPath().split(":")[-1] + "/" + key.GetName(), obj))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='')
+    parser.add_argument('file', action='store')
+    parser.add_argument('-q', '--quantiles', action='store', dest='quantiles', nargs='+', type=float,
+                        default=[0.001, 0.01, 0.5, 0.99, 0.999])
+    parser.add_argument('-v', '--variables', action='store', dest='variables', nargs='+', default=[])
+    parser.add_argument('-s', '--stages', action='store', dest='stages', nargs='+', type=int, default=[])
+    args = parser.parse_args()
+
+    sketches = []
+    collectSketches(ROOT.TFile.Open(args.file), sketches)
+    print("%-60s %10s " % ("sketch", "entries") + " ".join("%12s" % ("q=" + str(q)) for q in args.quantiles))
+    for name, sketch in sorted(sketches):
+        m = re.search(r'Quantile_(\w+)_CnC(\d+)$', name)
+        if not m:
+            continue
+        if args.variables and m.group(1) not in args.variables:
+            continue
+        if args.stages and int(m.group(2)) not in args.stages:
+            continue
+        total, values = quantiles(sketch, args.quantiles)
+        if total == 0:
+            continue
+        print("%-60s %10d " % (name, total) + " ".join("%12.5g" % v for v in values))
+
+
+if __name__ == "__main__" :
+    main()